@@ -43,15 +43,20 @@
 #include <cfloat>
 #include <array>
 #include <fstream>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "wsw_core.h"
+#include "wsw_pacer.h"
 
 #if !(USE_DOUBLE)
-typedef float     Float;
 typedef glm::vec3 Vec3;
 typedef glm::quat Quat;
 typedef glm::mat3 Mat3;
 typedef glm::mat4 Mat4;
 #else
-typedef double       Float;
 typedef glm::f64vec3 Vec3;
 typedef glm::dquat   Quat;
 typedef glm::dmat3   Mat3;
@@ -68,10 +73,6 @@ namespace {
   glm::vec3 cam_clamp_pos_max = glm::vec3(+3.0f, +5.5f, 15.0f);
   glm::vec3 cam_clamp_tgt_min = glm::vec3(-3.0f, -5.5f, +0.0f);
   glm::vec3 cam_clamp_tgt_max = glm::vec3(+3.0f, +5.5f, +0.0f);
-
-//  auto     &raw_data          = harbor_data;
-//  int       N                 = sqrt(sizeof(raw_data) / sizeof(float));
-  int       N                 = 400;
 };
 
 struct DebugInfo {
@@ -161,69 +162,6 @@ struct Shadow {
 
 struct Context;
 
-class ProfileBuffer{
-public:
-  std::vector<std::array<float, 4>> data;
-  void Precompute() {
-    
-  }
-};
-
-class Grid {
-public:
-private:
-  std::vector<Float> data;
-  std::array<int, 4> dimensions;
-};
-
-class Spectrum {
-public:
-  Spectrum(Float windSpeed) {
-    
-  }
-};
-
-class Environment {
-public:
-  float _dx;
-  Environment(Float size) : _dx((2 * size) / N) {
-    
-  }
-};
-class WaveGrid {
-private:
-  void advection_step(Float dt) {
-    
-  }
-  void diffusion_step(Float dt) {
-    
-  }
-  void precompute_profile_buffer() {
-
-  }
-public:
-  struct Settings {
-    Float size    = 50;
-    int   n_x     = 100;
-    int   n_theta = 8;
-    int   n_zeta  = 1;
-    enum SpectrumType {
-      LinearBasis,
-      PiersonMoskowitz
-    } spectrumType = PiersonMoskowitz;
-  };
-  Spectrum    m_spectrum;
-  Environment m_enviroment;
-  WaveGrid(Settings& s) : m_spectrum((Float)10.0), m_enviroment(s.size) {
-    
-  }
-  void TimeStep(Float dt) {
-    advection_step(dt);
-    diffusion_step(dt);
-    precompute_profile_buffer();
-  }
-};
-
 class WaterSurfaceMesh {
 public:
   WaterSurfaceMesh() {
@@ -418,49 +356,296 @@ Material mat_white = {
   32.0f,
 };
 
-void write_ppm(GLubyte* buff, GLenum format) {
-  int w = glutGet(GLUT_WINDOW_WIDTH);
-  int h = glutGet(GLUT_WINDOW_HEIGHT);
-  int  pix_sz = (format == GL_RGBA) ? 4 : 1;
-  char suffix[256];
-  sprintf(suffix, (format == GL_RGBA) ? "screen.ppm" : "depth.ppm");
-  char filename[1024];
-  sprintf(filename, "%08d_%s", g_Context.frame, suffix);
-  FILE *fp = fopen(filename, "wb");
-  if (fp) {
-    fprintf(fp, "P%d\n", (format == GL_RGBA) ? 6 : 5); // 5:Portable graymap(Binary), 6:Portable pixmap(Binary)
-    fprintf(fp, "%u %u\n", w, h);
-    fprintf(fp, "255\n");
-    for(int y = 0; y < h; y++) {
-      for(int x = 0; x < w; x++) {
-        int index = (h - y - 1) * w * pix_sz + (x * pix_sz);
-        if (format == GL_RGBA) {
-          int r = buff[index];
-          int g = buff[index + 1];
-          int b = buff[index + 2];
-          int a = buff[index + 3]; // not use here
-          putc(r, fp); // binary
-          putc(g, fp);
-          putc(b, fp);
-        } else {
-          putc(buff[index], fp);
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER 0x88EB
+#endif
+#ifndef GL_STREAM_READ
+#define GL_STREAM_READ       0x88E1
+#endif
+#ifndef GL_READ_ONLY
+#define GL_READ_ONLY         0x88B8
+#endif
+
+// Screenshots and USE_CAPTURE recording without stalling the render thread.
+// glReadPixels copies into a pixel pack buffer and returns at once; the
+// buffer is only mapped on the next frame, when the copy has finished. The
+// pixels go to a writer thread in one of a few reusable frame buffers, and
+// the writer flips the rows and writes each PPM with a single fwrite. When
+// every frame buffer is still queued (the disk is slower than the frame
+// rate) a screenshot is dropped and counted, the frame rate is kept; a
+// recorded frame waits for the writer instead, so none is lost.
+class FrameCapture {
+public:
+  static const int PackBuffers  = 2;
+  static const int FrameBuffers = 4;
+  FrameCapture() : m_request(0), m_record(false), m_next(0), m_displays(0), m_ready(false), m_quit(false), m_written(0), m_dropped(0) {}
+  ~FrameCapture() { Close(); }
+  // capture the next displayed frame in format (GL_RGBA or GL_DEPTH_COMPONENT);
+  // record: wait for a free frame buffer rather than drop the frame
+  void Request(GLenum format, bool record = false) { m_request = format; m_record = record; }
+  // call once per displayed frame, before the buffer swap
+  void Display(std::uint32_t frame);
+  // writes what is in flight (needs the GL context) and stops the writer
+  void Close();
+  int  Written() const { return m_written; }
+  int  Dropped() const { return m_dropped; }
+private:
+  struct Frame {
+    std::vector<GLubyte> pixels;
+    GLenum               format;
+    int                  w, h;
+    std::uint32_t        frame;
+  };
+  struct Pack {
+    GLuint        pbo      = 0;
+    size_t        capacity = 0;
+    bool          busy     = false;
+    bool          record   = false;
+    GLenum        format   = 0;
+    int           w = 0, h = 0;
+    std::uint32_t frame    = 0;
+    std::uint64_t issued   = 0; // display of the read
+  };
+  typedef void      (APIENTRY* GenBuffersFn)(GLsizei, GLuint*);
+  typedef void      (APIENTRY* DeleteBuffersFn)(GLsizei, const GLuint*);
+  typedef void      (APIENTRY* BindBufferFn)(GLenum, GLuint);
+  typedef void      (APIENTRY* BufferDataFn)(GLenum, std::ptrdiff_t, const void*, GLenum);
+  typedef void*     (APIENTRY* MapBufferFn)(GLenum, GLenum);
+  typedef GLboolean (APIENTRY* UnmapBufferFn)(GLenum);
+  void  init();
+  Frame* acquire(bool record);
+  void  submit(Frame* f);
+  void  collect(Pack& p);
+  void  writer_main();
+  static size_t pixel_size(GLenum format) { return (format == GL_RGBA) ? 4 : 1; }
+
+  GenBuffersFn            m_genBuffers    = nullptr;
+  DeleteBuffersFn         m_deleteBuffers = nullptr;
+  BindBufferFn            m_bindBuffer    = nullptr;
+  BufferDataFn            m_bufferData    = nullptr;
+  MapBufferFn             m_mapBuffer     = nullptr;
+  UnmapBufferFn           m_unmapBuffer   = nullptr;
+  GLenum                  m_request;  // 0: none
+  bool                    m_record;
+  Pack                    m_packs[PackBuffers];
+  int                     m_next;     // pack buffer of the next read
+  std::uint64_t           m_displays;
+  Frame                   m_frames[FrameBuffers];
+  std::vector<Frame*>     m_free;     // guarded by m_lock, as is m_queue
+  std::deque<Frame*>      m_queue;
+  std::thread             m_writer;
+  std::mutex              m_lock;
+  std::condition_variable m_wake;
+  bool                    m_ready;
+  bool                    m_quit;
+  std::atomic<int>        m_written;
+  std::atomic<int>        m_dropped;
+};
+
+// the pack buffer entry points are GL 1.5/2.1, past what GL/gl.h declares on
+// every platform; without them reads fall back to a plain glReadPixels
+void FrameCapture::init() {
+#if defined(__APPLE__) || defined(MACOSX)
+  m_genBuffers    = glGenBuffers;
+  m_deleteBuffers = glDeleteBuffers;
+  m_bindBuffer    = glBindBuffer;
+  m_bufferData    = (BufferDataFn)glBufferData;
+  m_mapBuffer     = glMapBuffer;
+  m_unmapBuffer   = glUnmapBuffer;
+#elif defined(__FREEGLUT_EXT_H__)
+  m_genBuffers    = (GenBuffersFn)glutGetProcAddress("glGenBuffers");
+  m_deleteBuffers = (DeleteBuffersFn)glutGetProcAddress("glDeleteBuffers");
+  m_bindBuffer    = (BindBufferFn)glutGetProcAddress("glBindBuffer");
+  m_bufferData    = (BufferDataFn)glutGetProcAddress("glBufferData");
+  m_mapBuffer     = (MapBufferFn)glutGetProcAddress("glMapBuffer");
+  m_unmapBuffer   = (UnmapBufferFn)glutGetProcAddress("glUnmapBuffer");
+#endif
+  if (!(m_genBuffers && m_deleteBuffers && m_bindBuffer && m_bufferData && m_mapBuffer && m_unmapBuffer)) {
+    m_genBuffers = nullptr;
+  }
+  for (Pack& p : m_packs) {
+    if (m_genBuffers) {
+      m_genBuffers(1, &p.pbo);
+    }
+  }
+  for (Frame& f : m_frames) {
+    m_free.push_back(&f);
+  }
+  m_writer = std::thread(&FrameCapture::writer_main, this);
+  m_ready  = true;
+}
+
+// the writer frees a frame buffer whenever all of them are queued, so a
+// recorded frame never waits for long
+FrameCapture::Frame* FrameCapture::acquire(bool record) {
+  std::unique_lock<std::mutex> guard(m_lock);
+  if (record) {
+    m_wake.wait(guard, [&] { return !m_free.empty(); });
+  }
+  if (m_free.empty()) {
+    m_dropped++;
+    return nullptr;
+  }
+  Frame* f = m_free.back();
+  m_free.pop_back();
+  return f;
+}
+
+void FrameCapture::submit(Frame* f) {
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_queue.push_back(f);
+  }
+  m_wake.notify_one();
+}
+
+// maps a finished read and hands the pixels to the writer
+void FrameCapture::collect(Pack& p) {
+  p.busy = false;
+  m_bindBuffer(GL_PIXEL_PACK_BUFFER, p.pbo);
+  const GLubyte* src = (const GLubyte*)m_mapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+  Frame*         f   = src ? acquire(p.record) : nullptr;
+  if (f) {
+    f->format = p.format;
+    f->w      = p.w;
+    f->h      = p.h;
+    f->frame  = p.frame;
+    f->pixels.assign(src, src + (size_t)p.w * p.h * pixel_size(p.format));
+    submit(f);
+  }
+  if (src) {
+    m_unmapBuffer(GL_PIXEL_PACK_BUFFER);
+  }
+  m_bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void FrameCapture::Display(std::uint32_t frame) {
+  if (!m_ready) {
+    if (!m_request) {
+      return;
+    }
+    init();
+  }
+  m_displays++;
+  GLenum format = m_request;
+  bool   record = m_record;
+  m_request = 0;
+  int    w      = glutGet(GLUT_WINDOW_WIDTH);
+  int    h      = glutGet(GLUT_WINDOW_HEIGHT);
+  size_t bytes  = (size_t)w * h * (format ? pixel_size(format) : 0);
+  if (format) {
+    glPixelStorei(GL_PACK_ALIGNMENT, 1); // depth rows are w bytes, unpadded
+    glReadBuffer(GL_BACK);
+  }
+  if (format && !m_genBuffers) {
+    if (Frame* f = acquire(record)) {
+      f->format = format;
+      f->w      = w;
+      f->h      = h;
+      f->frame  = frame;
+      f->pixels.resize(bytes);
+      glReadPixels(0, 0, w, h, format, GL_UNSIGNED_BYTE, f->pixels.data());
+      submit(f);
+    }
+  } else if (format) {
+    Pack& p = m_packs[m_next];
+    if (p.busy) {
+      collect(p); // reads every frame with all pack buffers in flight: wait for the oldest
+    }
+    m_bindBuffer(GL_PIXEL_PACK_BUFFER, p.pbo);
+    if (p.capacity < bytes) {
+      m_bufferData(GL_PIXEL_PACK_BUFFER, (std::ptrdiff_t)bytes, nullptr, GL_STREAM_READ);
+      p.capacity = bytes;
+    }
+    glReadPixels(0, 0, w, h, format, GL_UNSIGNED_BYTE, nullptr);
+    m_bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    p.busy   = true;
+    p.record = record;
+    p.format = format;
+    p.w      = w;
+    p.h      = h;
+    p.frame  = frame;
+    p.issued = m_displays;
+    m_next   = (m_next + 1) % PackBuffers;
+  }
+  // reads of earlier displays have had a whole frame to finish
+  for (Pack& p : m_packs) {
+    if (p.busy && p.issued < m_displays) {
+      collect(p);
+    }
+  }
+}
+
+void FrameCapture::writer_main() {
+  std::vector<GLubyte> out;
+  for (;;) {
+    Frame* f;
+    {
+      std::unique_lock<std::mutex> guard(m_lock);
+      m_wake.wait(guard, [&] { return m_quit || !m_queue.empty(); });
+      if (m_queue.empty()) {
+        return;
+      }
+      f = m_queue.front();
+      m_queue.pop_front();
+    }
+    // GL rows are bottom up; PPM is top down and RGB (P6) or gray (P5)
+    bool   rgb = f->format == GL_RGBA;
+    size_t row = (size_t)f->w * (rgb ? 3 : 1);
+    out.resize(row * f->h);
+    for (int y = 0; y < f->h; y++) {
+      const GLubyte* src = f->pixels.data() + (size_t)(f->h - y - 1) * f->w * pixel_size(f->format);
+      GLubyte*       dst = out.data() + row * y;
+      if (rgb) {
+        for (int x = 0; x < f->w; x++) {
+          dst[3 * x]     = src[4 * x];
+          dst[3 * x + 1] = src[4 * x + 1];
+          dst[3 * x + 2] = src[4 * x + 2];
         }
+      } else {
+        memcpy(dst, src, row);
       }
     }
-    fclose(fp);
+    char filename[1024];
+    sprintf(filename, "%08d_%s", f->frame, rgb ? "screen.ppm" : "depth.ppm");
+    bool ok = false;
+    if (FILE* fp = fopen(filename, "wb")) {
+      fprintf(fp, "P%d\n%u %u\n255\n", rgb ? 6 : 5, f->w, f->h); // 5:Portable graymap(Binary), 6:Portable pixmap(Binary)
+      ok = fwrite(out.data(), out.size(), 1, fp) == 1;
+      ok = (fclose(fp) == 0) && ok;
+    }
+    {
+      std::lock_guard<std::mutex> guard(m_lock);
+      m_written += ok ? 1 : 0;
+      m_free.push_back(f);
+    }
+    m_wake.notify_all(); // a recorded frame may be waiting in acquire
   }
 }
 
-void write_image(GLenum format) {
-  GLsizei w = glutGet(GLUT_WINDOW_WIDTH);
-  GLsizei h = glutGet(GLUT_WINDOW_HEIGHT);
-  GLubyte* buff = (GLubyte*)malloc((size_t)w * (size_t)h * 4); // w x h * RGBA
-  glReadBuffer(/*GL_FRONT*/GL_BACK);
-  glReadPixels(0, 0, w, h, format, GL_UNSIGNED_BYTE, buff);
-  write_ppm(buff, format);
-  free(buff);
+void FrameCapture::Close() {
+  if (!m_ready) {
+    return;
+  }
+  for (Pack& p : m_packs) {
+    if (p.busy) {
+      collect(p);
+    }
+    if (m_genBuffers) {
+      m_deleteBuffers(1, &p.pbo);
+    }
+  }
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_quit = true;
+  }
+  m_wake.notify_all();
+  m_writer.join();
+  m_ready = false;
 }
 
+FrameCapture g_Capture;
+
 void render_string(std::string& str, int w, int h, GLfloat x0, GLfloat y0) {
   glDisable(GL_LIGHTING);
   glMatrixMode(GL_PROJECTION);
@@ -624,6 +809,7 @@ void finalize(void) {
       delete ctx.scene;
       ctx.scene = nullptr;
   }
+  g_Capture.Close();
   finalize_imgui();
   return;
 }
@@ -753,7 +939,17 @@ void restart() {
   }
 }
 
-void time_step(GLfloat time);
+void time_step();
+
+// sim steps at fixed_dt in real time; recording steps once per displayed
+// frame instead, so every step is captured
+FramePacer::Settings pacer_settings() {
+  FramePacer::Settings s;
+  s.dt   = (double)fixed_dt;
+  s.mode = USE_CAPTURE ? FramePacer::AsFastAsPossible : FramePacer::RealTime;
+  return s;
+}
+FramePacer g_Pacer(pacer_settings());
 
 void display_imgui() {
   auto& ctx = g_Context;
@@ -767,6 +963,7 @@ void display_imgui() {
     ImGui::Checkbox("Show Depth",   &ctx.debug_info.show_depth);
     ImGui::SliderFloat("DoF",       &ctx.debug_info.dof,     0.0f,  0.2f);
     ImGui::SliderFloat("focus",     &ctx.debug_info.focus, - 5.0f,  3.5f);
+    ImGui::Text("captured %d, dropped %d", g_Capture.Written(), g_Capture.Dropped());
     ImGui::End();
  
     ImGui::Begin("Params");
@@ -776,12 +973,16 @@ void display_imgui() {
     ImGui::SameLine();
     if (ImGui::Button("Step")) {
       ctx.paused = true;
-      time_step((float)glutGet(GLUT_ELAPSED_TIME) / 1000.0f);
+      time_step();
     }
     ImGui::SameLine();
     if (ImGui::Button("Run")) {
       ctx.paused = false;
     }
+    bool real_time = g_Pacer.GetMode() == FramePacer::RealTime;
+    if (ImGui::Checkbox("Real time", &real_time)) {
+      g_Pacer.SetMode(real_time ? FramePacer::RealTime : FramePacer::AsFastAsPossible);
+    }
     ImGui::End();
     ImGui::Begin("Camera");
     if (ImGui::Button("Reset")) {
@@ -974,6 +1175,7 @@ void display(void){
   display_depth();
   display_imgui();
 
+  g_Capture.Display(g_Context.frame);
   glutSwapBuffers();
   glutPostRedisplay();
 }
@@ -1008,8 +1210,8 @@ void reshape(int width, int height){
 
 void keyboard(unsigned char key, int x , int y){
   switch(key) {
-  case 's': write_image(GL_RGBA); /*write_objects();*/ break;
-  case 'd': write_image(GL_DEPTH_COMPONENT); break;
+  case 's': g_Capture.Request(GL_RGBA); /*write_objects();*/ break;
+  case 'd': g_Capture.Request(GL_DEPTH_COMPONENT); break;
   case 'r': restart(); break;
   case 27: exit(0); break; // esc
   }
@@ -1032,33 +1234,31 @@ void special(int key, int x, int y) {
   }
 }
 
-void time_step(GLfloat time) {
+void time_step() {
   auto& ctx  = g_Context;
-  GLfloat dt = (GLfloat)fixed_dt;//time - ctx.time;
+  GLfloat dt = (GLfloat)fixed_dt;
   ctx.scene->Update(ctx, dt);
-  //ctx.time = time;
 #if USE_CAPTURE
-  keyboard('s', 0, 0); // screenshot
+  g_Capture.Request(GL_RGBA, true); // record: no step is dropped
 #endif
-  while(1) {
-    if (((float)glutGet(GLUT_ELAPSED_TIME) / 1000.0f - time) > fixed_dt) {
-      break; // keep 60fps
-    }
-  }
   ctx.frame++;
 }
 
 void idle(void){
-  GLfloat time = (float)glutGet(GLUT_ELAPSED_TIME) / 1000.0f;
-  auto&   ctx  = g_Context;
+  auto& ctx = g_Context;
   if (ctx.scene == nullptr) {
     switch(g_Context.scene_num) {
     case Scene::eDefault: ctx.scene = new SceneDefault(); break;
     }
   }
   if (ctx.paused == false) {
-    time_step(time);
+    for (int steps = g_Pacer.Advance(); steps > 0; steps--) {
+      time_step();
+    }
+  } else {
+    g_Pacer.Reset(); // no burst of catch-up steps on Run
   }
+  g_Pacer.Wait(); // the frame is displayed when the next step is due
 }
 
 void mouse_left_sub(int state, int x, int y) {
@@ -0,0 +1,71 @@
+// Body of the vectorized advection row kernel. Included once per instruction
+// set by wsw_simd.cpp, inside a namespace that defines the lane type V and
+// WSW_SIMD_TARGET. Mirrors WaveGrid::advected_amplitude operation for
+// operation so the result matches the scalar path.
+
+WSW_SIMD_TARGET void advect_row(const AdvectRow& r, Float* out, unsigned char* slow) {
+  typedef V::F F;
+  typedef V::M M;
+  const F zero   = V::set1((Float)0.0);
+  const F half   = V::set1((Float)0.5);
+  const F one    = V::set1((Float)1.0);
+  const F size   = V::set1(r.size);
+  const F nsize  = V::set1(-r.size);
+  const F dx     = V::set1(r.dx);
+  const F dt     = V::set1(r.dt);
+  const F dir_x  = V::set1(r.dir_x);
+  const F dir_y  = V::set1(r.dir_y);
+  const F py     = V::set1(r.y);
+  const F last   = V::set1((Float)(r.n - 1));
+  const F cell   = V::set1((Float)(r.n - 2));
+  const F amb    = V::set1(r.ambient);
+  const F lanes  = V::ramp();
+  int ix = r.begin;
+  for (;;) {
+    if (ix + V::width > r.end) {
+      // finish a ragged row with one vector overlapping the previous one
+      if (ix == r.end || r.end - r.begin < V::width) { break; }
+      ix = r.end - V::width;
+    }
+    F px  = V::add(V::mul(V::add(V::add(V::set1((Float)ix), lanes), half), dx), nsize);
+    F ls  = V::loadu(r.levelset + ix);
+    F dtc = V::mul(dt, V::loadu(r.speed + ix));
+    F sx  = V::sub(px, V::mul(dtc, dir_x));
+    F sy  = V::sub(py, V::mul(dtc, dir_y));
+    M wet    = V::ge(ls, zero);
+    M inside = V::and_(V::and_(V::ge(size, sx), V::ge(sx, nsize)), V::and_(V::ge(size, sy), V::ge(sy, nsize)));
+    // the levelset is 1-Lipschitz, so a node this far from the shore
+    // cannot trace back onto land
+    M open   = V::ge(ls, V::add(dtc, dx));
+    // the offset in nodes, split into its floor and fraction as
+    // WaveGrid::traced_bilinear does
+    F ox = V::sub(zero, V::div(V::mul(dtc, dir_x), dx));
+    F oy = V::sub(zero, V::div(V::mul(dtc, dir_y), dx));
+    F tx = V::trunc(ox);
+    F ty = V::trunc(oy);
+    tx   = V::select(V::ge(ox, tx), tx, V::sub(tx, one));
+    ty   = V::select(V::ge(oy, ty), ty, V::sub(ty, one));
+    F x0 = V::add(V::add(V::set1((Float)ix), lanes), tx);
+    F y0 = V::add(V::set1((Float)r.iy), ty);
+    F wx = V::select(V::ge(x0, last), one, V::select(V::ge(x0, zero), V::sub(ox, tx), zero));
+    F wy = V::select(V::ge(y0, last), one, V::select(V::ge(y0, zero), V::sub(oy, ty), zero));
+    x0   = V::min(V::max(x0, zero), cell);
+    y0   = V::min(V::max(y0, zero), cell);
+    F a00 = V::gather(r.slice,           x0, y0, r.n);
+    F a10 = V::gather(r.slice + 1,       x0, y0, r.n);
+    F a01 = V::gather(r.slice + r.n,     x0, y0, r.n);
+    F a11 = V::gather(r.slice + r.n + 1, x0, y0, r.n);
+    F ux  = V::sub(one, wx);
+    F v   = V::add(V::mul(V::sub(one, wy), V::add(V::mul(ux, a00), V::mul(wx, a10))),
+                   V::mul(wy,              V::add(V::mul(ux, a01), V::mul(wx, a11))));
+    V::storeu(out + (ix - r.begin), V::select(wet, V::select(inside, v, amb), zero));
+    unsigned need = V::bits(wet) & ((V::bits(inside) & ~V::bits(open)) | (~V::bits(inside) & r.outside));
+    for (int l = 0; l < V::width; l++) {
+      slow[ix - r.begin + l] = (unsigned char)((need >> l) & 1);
+    }
+    ix += V::width;
+  }
+  for (; ix < r.end; ix++) {
+    slow[ix - r.begin] = 1;
+  }
+}
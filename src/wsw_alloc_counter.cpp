@@ -0,0 +1,45 @@
+// Replacement of the global operator new/delete family, counting every heap
+// allocation; see wsw_alloc_counter.h.
+#include "wsw_alloc_counter.h"
+#include "wsw_core.h"
+#include <cstdlib>
+#include <atomic>
+#include <new>
+
+static std::atomic<long long> g_allocations(0);
+
+long long wsw::heap_allocations() { return g_allocations; }
+
+// the whole family is replaced, so every delete matches its new; GCC 12
+// still pairs the free in an inlined delete with the library's operator new
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void* operator new(size_t bytes) {
+  g_allocations++;
+  if (void* p = malloc(bytes ? bytes : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+void* operator new[](size_t bytes) { return operator new(bytes); }
+void* operator new(size_t bytes, std::align_val_t align) {
+  g_allocations++;
+  if (void* p = wsw::aligned_alloc_bytes(bytes ? bytes : 1, (size_t)align)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+void* operator new[](size_t bytes, std::align_val_t align) { return operator new(bytes, align); }
+void operator delete(void* p) noexcept                                 { free(p); }
+void operator delete(void* p, size_t) noexcept                         { free(p); }
+void operator delete[](void* p) noexcept                               { free(p); }
+void operator delete[](void* p, size_t) noexcept                       { free(p); }
+void operator delete(void* p, std::align_val_t) noexcept               { wsw::aligned_free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept       { wsw::aligned_free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept             { wsw::aligned_free(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept     { wsw::aligned_free(p); }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
@@ -0,0 +1,13 @@
+#ifndef WSW_ALLOC_COUNTER_H
+#define WSW_ALLOC_COUNTER_H
+
+// Counts every heap allocation of the process. wsw_alloc_counter.cpp
+// replaces the global operator new/delete family, so it is compiled into
+// the executables that count (wsw_bench, wsw_tests), not into wsw_core.
+
+namespace wsw {
+  // allocations made since the process started
+  long long heap_allocations();
+}
+
+#endif
@@ -0,0 +1,950 @@
+// Benchmarks for the wsw_core solver.
+//   wsw_bench [--steps N] [--n_x N] [--n_theta N] [--n_zeta N] [--threads N] [--cache DIR]
+//   wsw_bench --json FILE [--steps N] [--n_x N,N..] [--n_theta N,N..] [--n_zeta N,N..] [--spectrum linear|pm|jonswap|tma|both|all] [--threads N]
+// The second form times every phase over the matrix of the listed settings
+// and writes the report as JSON to FILE ("-" for stdout).
+#include "wsw_core.h"
+#include "wsw_lod.h"
+#include "wsw_ensemble.h"
+#include "wsw_export.h"
+#include "wsw_pacer.h"
+#include "wsw_alloc_counter.h"
+#include "wsw_compare.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <ctime>
+
+namespace {
+  typedef std::chrono::steady_clock clock;
+
+  const char* layout_name(Grid::Layout l) { return (l == Grid::Tiled) ? "tiled" : "linear"; }
+
+  // every phase reads the amplitude grid once and writes it once
+  double bandwidth_gbs(const Grid& g, double seconds_per_step) {
+    return 2.0 * (double)g.Bytes() / seconds_per_step * 1e-9;
+  }
+
+  // advection's memory access pattern without its arithmetic: every cell
+  // gathers the four bilinear corners one and a half cells upstream along theta
+  template <Grid::Layout L>
+  double upstream_gather(Grid& src, Grid& dst, int steps) {
+    GridAccessor<L, const Float> a = src.ConstView<L>();
+    GridAccessor<L, Float>       b = dst.View<L>();
+    int n  = src.Dimension(Grid::X);
+    int nt = src.Dimension(Grid::Theta);
+    std::vector<int> ox(nt), oy(nt);
+    for (int it = 0; it < nt; it++) {
+      Float t = (it + (Float)0.5) * wsw::tau / nt;
+      ox[it] = (int)std::floor((Float)-1.5 * std::cos(t));
+      oy[it] = (int)std::floor((Float)-1.5 * std::sin(t));
+    }
+    clock::time_point t0 = clock::now();
+    for (int step = 0; step < steps; step++) {
+      dst.ForEachCell<L>([&](int ix, int iy, int itheta, int izeta) {
+        int x0 = glm::clamp(ix + ox[itheta], 0, n - 2);
+        int y0 = glm::clamp(iy + oy[itheta], 0, n - 2);
+        b(ix, iy, itheta, izeta) = (Float)0.25 * (a(x0, y0, itheta, izeta) + a(x0 + 1, y0, itheta, izeta) + a(x0, y0 + 1, itheta, izeta) + a(x0 + 1, y0 + 1, itheta, izeta));
+      });
+    }
+    return std::chrono::duration<double>(clock::now() - t0).count() / steps;
+  }
+
+  void bench_access(const WaveGrid::Settings& s, Grid::Layout layout, int steps) {
+    Grid src, dst;
+    src.Resize(s.n_x, s.n_x, s.n_theta, s.n_zeta, layout, (Float)1.0);
+    dst.Resize(s.n_x, s.n_x, s.n_theta, s.n_zeta, layout);
+    double t = (layout == Grid::Tiled) ? upstream_gather<Grid::Tiled>(src, dst, steps) : upstream_gather<Grid::Linear>(src, dst, steps);
+    printf("%-7s upstream gather %8.3f ms (%6.2f GB/s)\n", layout_name(layout), t * 1e3, bandwidth_gbs(src, t));
+  }
+
+  void bench_layout(WaveGrid::Settings s, Grid::Layout layout, int steps) {
+    s.layout = layout;
+    s.fused  = false;
+    WaveGrid grid(s);
+    grid.TimeStep((Float)(1.0 / 60.0)); // warm up
+    grid.ResetTimings();
+    for (int i = 0; i < steps; i++) {
+      grid.TimeStep((Float)(1.0 / 60.0));
+    }
+    const WaveGrid::Timings& t = grid.GetTimings();
+    double adv = t.advection / t.steps;
+    double dif = t.diffusion / t.steps;
+    printf("%-7s advection %8.3f ms (%6.2f GB/s)  diffusion %8.3f ms (%6.2f GB/s)\n", layout_name(layout),
+           adv * 1e3, bandwidth_gbs(grid.Amplitude(), adv), dif * 1e3, bandwidth_gbs(grid.Amplitude(), dif));
+  }
+
+  // every vectorized advection kernel the CPU supports against the scalar reference
+  void bench_simd(WaveGrid::Settings s, int steps) {
+    s.layout = Grid::Linear;
+    s.fused  = false;
+    s.simd   = wsw::Scalar;
+    WaveGrid reference(s);
+    for (int i = 0; i < steps; i++) {
+      reference.TimeStep((Float)(1.0 / 60.0));
+    }
+    double scalar = reference.GetTimings().advection / steps;
+    printf("%-7s advection %8.3f ms\n", wsw::simd_isa_name(wsw::Scalar), scalar * 1e3);
+    for (int isa = wsw::SSE2; isa <= wsw::best_simd_isa(); isa++) {
+      s.simd = (wsw::SimdIsa)isa;
+      WaveGrid grid(s);
+      for (int i = 0; i < steps; i++) {
+        grid.TimeStep((Float)(1.0 / 60.0));
+      }
+      double adv = grid.GetTimings().advection / steps;
+      printf("%-7s advection %8.3f ms (x%.2f)  max |simd - scalar| = %g\n", wsw::simd_isa_name(grid.ActiveSimd()),
+             adv * 1e3, scalar / adv, (double)wsw::max_difference(grid.Amplitude(), reference.Amplitude()));
+    }
+  }
+
+  // the tiled passes on 1..max_threads threads; the result must not change
+  void bench_threads(WaveGrid::Settings s, int steps, int max_threads) {
+    s.fused   = false;
+    s.threads = 1;
+    WaveGrid reference(s);
+    for (int i = 0; i < steps; i++) {
+      reference.TimeStep((Float)(1.0 / 60.0));
+    }
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+      s.threads = threads;
+      WaveGrid grid(s);
+      for (int i = 0; i < steps; i++) {
+        grid.TimeStep((Float)(1.0 / 60.0));
+      }
+      const WaveGrid::Timings& t = grid.GetTimings();
+      printf("%2d threads advection %8.3f ms  diffusion %8.3f ms  max |grid - 1 thread| = %g\n", threads,
+             t.advection / steps * 1e3, t.diffusion / steps * 1e3, (double)wsw::max_difference(grid.Amplitude(), reference.Amplitude()));
+    }
+  }
+
+  // two-pass advection + diffusion against the fused single pass
+  void bench_fused(WaveGrid::Settings s, int steps) {
+    s.fused = false;
+    WaveGrid two_pass(s);
+    s.fused = true;
+    WaveGrid fused(s);
+    for (int i = 0; i < steps; i++) {
+      two_pass.TimeStep((Float)(1.0 / 60.0));
+      fused.TimeStep((Float)(1.0 / 60.0));
+    }
+    double split = (two_pass.GetTimings().advection + two_pass.GetTimings().diffusion) / steps;
+    double once  = fused.GetTimings().fused / steps;
+    printf("two-pass %8.3f ms (%6.2f GB/s)  fused %8.3f ms (%6.2f GB/s, x%.2f)  max |fused - two-pass| = %g\n",
+           split * 1e3, 2 * bandwidth_gbs(two_pass.Amplitude(), split), once * 1e3, bandwidth_gbs(fused.Amplitude(), once),
+           split / once, (double)wsw::max_difference(fused.Amplitude(), two_pass.Amplitude()));
+  }
+
+  // open-water slices advected by the uniform shift stencil against the
+  // backtrace per node
+  void bench_shift(WaveGrid::Settings s, int steps) {
+    s.uniform_shift = false;
+    WaveGrid backtrace(s);
+    s.uniform_shift = true;
+    WaveGrid shifted(s);
+    for (int i = 0; i < steps; i++) {
+      backtrace.TimeStep((Float)(1.0 / 60.0));
+      shifted.TimeStep((Float)(1.0 / 60.0));
+    }
+    const WaveGrid::Timings& b = backtrace.GetTimings();
+    const WaveGrid::Timings& u = shifted.GetTimings();
+    double off = (s.fused ? b.fused : b.advection) / steps;
+    double on  = (s.fused ? u.fused : u.advection) / steps;
+    printf("backtrace %8.3f ms  uniform shift %8.3f ms (x%.2f, %.1f%% of the cells shifted)  max |shift - backtrace| = %g\n",
+           off * 1e3, on * 1e3, off / on, 100.0 * u.shifted / u.cells, (double)wsw::max_difference(shifted.Amplitude(), backtrace.Amplitude()));
+  }
+
+  // backtraces resolved once into cached stencils against tracing them every
+  // step, with and without the uniform shift taking the open water
+  void bench_stencils(WaveGrid::Settings s, int steps) {
+    for (int shift = 0; shift <= 1; shift++) {
+      s.uniform_shift   = shift != 0;
+      s.cached_stencils = false;
+      WaveGrid traced(s);
+      s.cached_stencils = true;
+      WaveGrid cached(s);
+      for (int i = 0; i < steps; i++) {
+        traced.TimeStep((Float)(1.0 / 60.0));
+        cached.TimeStep((Float)(1.0 / 60.0));
+      }
+      const WaveGrid::Timings& a = traced.GetTimings();
+      const WaveGrid::Timings& c = cached.GetTimings();
+      double off = (a.fused + a.advection) / steps;
+      double on  = (c.fused + c.advection) / steps;
+      printf("%-8s %-8s shift %-3s traced %8.3f ms  stencils %8.3f ms (x%.2f, %6.1f MB = %.2fx a buffer, built in %7.3f ms)  max |stencils - traced| = %g\n",
+             layout_name(s.layout), s.fused ? "fused" : "two-pass", shift ? "on" : "off", off * 1e3, on * 1e3, off / on,
+             cached.StencilBytes() / 1048576.0, (double)cached.StencilBytes() / cached.Amplitude().Bytes(), c.stencils * 1e3,
+             (double)wsw::max_difference(cached.Amplitude(), traced.Amplitude()));
+    }
+  }
+
+  // every band stepped once per call against multi-rate stepping, compared
+  // after a whole number of the longest period, when every band has caught
+  // up. The shore reflection depends on the step length and the reflected
+  // waves carry the difference a few nodes out, so away from ShoreNodes of
+  // it the amplitudes must agree within tolerance of the peak (0 reports only)
+  const Float ShoreNodes = 8;
+  void bench_bands(WaveGrid::Settings s, int steps, Float dt, Float courant, Float tolerance) {
+    steps = (steps + s.max_band_period - 1) / s.max_band_period * s.max_band_period;
+    s.band_courant = 0;
+    WaveGrid every(s);
+    s.band_courant = courant;
+    WaveGrid bands(s);
+    for (int i = 0; i < steps; i++) {
+      every.TimeStep(dt);
+      bands.TimeStep(dt);
+    }
+    wsw::ShoreDifference amp = wsw::shore_difference(bands, every, ShoreNodes);
+    double height_peak;
+    double height = wsw::height_difference(bands, every, height_peak);
+    const WaveGrid::Timings& e = every.GetTimings();
+    const WaveGrid::Timings& b = bands.GetTimings();
+    double off = (e.fused + e.advection + e.diffusion) / steps;
+    double on  = (b.fused + b.advection + b.diffusion) / steps;
+    bool   ok  = tolerance <= 0 || amp.open <= tolerance * amp.peak;
+    printf("dt %6.4f courant %4.2f substeps %2d: every call %8.3f ms  multi-rate %8.3f ms (x%.2f)  max |amplitude - every call| = %.2g of peak within %g nodes of the shore, %.2g elsewhere  max |height - every call| = %g (%.2g of peak)%s\n",
+           (double)dt, (double)courant, s.max_band_substeps, off * 1e3, on * 1e3, off / on, (double)(amp.shore / amp.peak), (double)ShoreNodes, (double)(amp.open / amp.peak),
+           height, height / height_peak, ok ? "" : " FAILED");
+    for (int izeta = 0; izeta < s.n_zeta; izeta++) {
+      const WaveGrid::BandTimings& t = bands.GetBandTimings()[izeta];
+      printf("  band %d: %2d substeps every %d calls, %5lld steps, %8.3f ms per call\n", izeta, t.substeps, t.period, t.steps,
+             t.seconds * 1e3 / steps);
+    }
+  }
+
+  // bands stored coarser by their wavelength against every band at n_x:
+  // memory, step time and the surface, which must stay within the bound of
+  // each spacing (about twice what n_x 128 and 400 measure)
+  void bench_resolution(WaveGrid::Settings s, int steps) {
+    s.band_spacing = 0;
+    WaveGrid reference(s);
+    for (int i = 0; i < steps; i++) {
+      reference.TimeStep((Float)(1.0 / 60.0));
+    }
+    const WaveGrid::Timings& r    = reference.GetTimings();
+    double                   full = (r.fused + r.advection + r.diffusion) / steps;
+    const Float bounds[][2] = { { (Float)0.5, (Float)0.01 }, { (Float)1.0, (Float)0.2 }, { (Float)4.0, (Float)0.4 } };
+    for (const Float* b : bounds) {
+      Float spacing  = b[0];
+      s.band_spacing = spacing;
+      WaveGrid grid(s);
+      for (int i = 0; i < steps; i++) {
+        grid.TimeStep((Float)(1.0 / 60.0));
+      }
+      char nodes[64] = "";
+      for (int izeta = 0; izeta < s.n_zeta && izeta < 8; izeta++) {
+        snprintf(nodes + strlen(nodes), sizeof(nodes) - strlen(nodes), "%s%d", izeta ? "," : "", grid.Amplitude().GetBand(izeta).n_x);
+      }
+      double                   height_peak;
+      double                   height = wsw::height_difference(grid, reference, height_peak);
+      const WaveGrid::Timings& t      = grid.GetTimings();
+      double                   step   = (t.fused + t.advection + t.diffusion) / steps;
+      bool                     ok     = height <= b[1] * height_peak;
+      printf("%-7s spacing %3.1f wavelengths: n_x %-16s %7.1f of %7.1f MB  %8.3f of %8.3f ms/step (x%.2f)  max |height - n_x| = %g (%.2g of peak, bound %.2g)%s\n",
+             layout_name(s.layout), (double)spacing, nodes, grid.Amplitude().Bytes() / 1048576.0, reference.Amplitude().Bytes() / 1048576.0,
+             step * 1e3, full * 1e3, full / step, height, height / height_peak, (double)b[1], ok ? "" : " FAILED");
+    }
+  }
+
+  // bands below a share of the energy suspended against every band live,
+  // then the wind dropped so the short bands' share grows and they resume
+  void bench_culling(WaveGrid::Settings s, int steps) {
+    const Float dt = (Float)(1.0 / 60.0);
+    s.band_cull_fraction = 0;
+    WaveGrid reference(s);
+    clock::time_point t0 = clock::now();
+    for (int i = 0; i < steps; i++) {
+      reference.TimeStep(dt);
+    }
+    double full = std::chrono::duration<double>(clock::now() - t0).count() / steps;
+    for (Float fraction : { (Float)0.001, (Float)0.01 }) {
+      s.band_cull_fraction = fraction;
+      WaveGrid grid(s);
+      t0 = clock::now();
+      for (int i = 0; i < steps; i++) {
+        grid.TimeStep(dt);
+      }
+      double step = std::chrono::duration<double>(clock::now() - t0).count() / steps;
+      double height_peak;
+      double height = wsw::height_difference(grid, reference, height_peak);
+      printf("cull below %5.3f of the energy: %d of %d bands live  %8.3f of %8.3f ms/step (x%.2f, %.3f ms measuring)  max |height - all| = %g (%.2g of peak)\n",
+             (double)fraction, grid.LiveBands(), s.n_zeta, step * 1e3, full * 1e3, full / step, grid.GetTimings().energy / steps * 1e3,
+             height, height / height_peak);
+    }
+    s.band_cull_fraction = (Float)0.01;
+    WaveGrid grid(s);
+    for (int i = 0; i < steps; i++) {
+      grid.TimeStep(dt);
+    }
+    char live[2][64] = { "", "" };
+    for (int i = 0; i < 2; i++) {
+      for (int izeta = 0; izeta < s.n_zeta && izeta < 63; izeta++) {
+        live[i][izeta] = grid.GetBandTimings()[izeta].live ? '#' : '.';
+      }
+      if (i == 0) {
+        WaveGrid::Settings calm = s;
+        calm.spectrum.wind_speed = s.spectrum.wind_speed / 10;
+        grid.SetSpectrum(WaveGrid::MakeSpectrum(calm));
+        grid.TimeStep(dt);
+      }
+    }
+    printf("cull below 0.010 of the energy: wind %.1f -> %.1f m/s, live bands %s -> %s\n", (double)s.spectrum.wind_speed,
+           (double)s.spectrum.wind_speed / 10, live[0], live[1]);
+  }
+
+  // a sea starting at rest, stepped densely and with calm tiles skipped; with
+  // a zero threshold both must agree exactly
+  void bench_sparse(WaveGrid::Settings s, int steps) {
+    s.calm_start = true;
+    s.sparse     = false;
+    WaveGrid dense(s);
+    s.sparse     = true;
+    WaveGrid sparse(s);
+    for (int i = 0; i < steps; i++) {
+      dense.TimeStep((Float)(1.0 / 60.0));
+      sparse.TimeStep((Float)(1.0 / 60.0));
+    }
+    double full = dense.GetTimings().fused / steps;
+    double part = sparse.GetTimings().fused / steps;
+    printf("calm start: dense %8.3f ms  sparse %8.3f ms (x%.2f, %.0f of %d tiles)  max |sparse - dense| = %g\n",
+           full * 1e3, part * 1e3, full / part, (double)sparse.GetTimings().tiles / steps, sparse.TileCount(),
+           (double)wsw::max_difference(sparse.Amplitude(), dense.Amplitude()));
+  }
+
+  const char* storage_name(Grid::Storage s) { return (s == Grid::Half) ? "half" : (s == Grid::BFloat16) ? "bf16" : "full"; }
+
+  // 16 bit amplitude storage against full precision: speed, memory, and the
+  // error of the amplitudes and of the surface they produce
+  void bench_storage(WaveGrid::Settings s, int steps) {
+    s.storage = Grid::Full;
+    WaveGrid reference(s);
+    for (int i = 0; i < steps; i++) {
+      reference.TimeStep((Float)(1.0 / 60.0));
+    }
+    Float peak = 0;
+    reference.Amplitude().ForEachCell<Grid::Linear>([&](int ix, int iy, int itheta, int izeta) {
+      peak = std::max(peak, std::abs(reference.Amplitude()(ix, iy, itheta, izeta)));
+    });
+    for (int storage = Grid::Full; storage <= Grid::BFloat16; storage++) {
+      s.storage = (Grid::Storage)storage;
+      WaveGrid grid(s);
+      for (int i = 0; i < steps; i++) {
+        grid.TimeStep((Float)(1.0 / 60.0));
+      }
+      double height_peak;
+      double height = wsw::height_difference(grid, reference, height_peak);
+      const WaveGrid::Timings& t = grid.GetTimings();
+      printf("storage %s: %8.3f ms/step  %7.1f MB/buffer  max |amplitude - full| = %g (%.2g of peak)  max |height - full| = %g (%.2g of peak)\n",
+             storage_name(grid.Amplitude().GetStorage()), (t.fused + t.advection + t.diffusion) / steps * 1e3, grid.Amplitude().Bytes() / 1048576.0,
+             (double)wsw::max_difference(grid.Amplitude(), reference.Amplitude()), (double)(wsw::max_difference(grid.Amplitude(), reference.Amplitude()) / peak),
+             height, height / height_peak);
+    }
+  }
+
+  // adaptive theta strides against every direction everywhere
+  void bench_theta(WaveGrid::Settings s, int steps) {
+    WaveGrid reference(s);
+    s.max_theta_stride = std::max(s.n_theta / 4, 1);
+    WaveGrid adaptive(s);
+    for (int i = 0; i < steps; i++) {
+      reference.TimeStep((Float)(1.0 / 60.0));
+      adaptive.TimeStep((Float)(1.0 / 60.0));
+    }
+    double err = 0, peak = 0;
+    for (int j = 0; j < 256; j++) {
+      Vec2  pos = s.size * Vec2((Float)(-0.95 + 1.9 * (j % 16) / 15.0), (Float)(-0.95 + 1.9 * (j / 16) / 15.0));
+      Float ref = reference.WaterSurface(pos).z;
+      err  = std::max(err,  (double)std::abs(adaptive.WaterSurface(pos).z - ref));
+      peak = std::max(peak, (double)std::abs(ref));
+    }
+    const WaveGrid::Timings& a = adaptive.GetTimings();
+    const WaveGrid::Timings& r = reference.GetTimings();
+    // the ambient sea is smooth in theta, so some open-water tile must coarsen
+    bool ok = s.max_theta_stride == 1 || a.cells < r.cells;
+    printf("theta strides up to %d: %8.3f ms/step vs %8.3f ms, %.1f%% of the cells stepped  max |height - every direction| = %g (peak %g)%s\n",
+           s.max_theta_stride, a.fused / steps * 1e3, r.fused / steps * 1e3, 100.0 * a.cells / r.cells, err, peak, ok ? "" : " FAILED");
+  }
+
+  // a clipmap against one uniform grid over its whole extent at level 0's
+  // spacing, compared on the surface inside level 0
+  void bench_lod(WaveGrid::Settings s, int steps, int levels) {
+    const Float dt = (Float)(1.0 / 60.0);
+    WaveClipmap::Settings c;
+    c.level  = s;
+    c.levels = levels;
+    WaveClipmap clipmap(c);
+    s.n_x        = clipmap.Level(0).GetSettings().n_x << (levels - 1);
+    s.size       = c.level.size * (Float)(1 << (levels - 1));
+    s.scene_size = c.level.size;
+    WaveGrid uniform(s);
+    clock::time_point t0 = clock::now();
+    for (int i = 0; i < steps; i++) {
+      uniform.TimeStep(dt);
+    }
+    double full = std::chrono::duration<double>(clock::now() - t0).count() / steps;
+    t0 = clock::now();
+    for (int i = 0; i < steps; i++) {
+      clipmap.TimeStep(dt);
+    }
+    double lod = std::chrono::duration<double>(clock::now() - t0).count() / steps;
+    double err = 0, peak = 0;
+    for (int j = 0; j < 256; j++) {
+      Vec2  pos = c.level.size * Vec2((Float)(-0.95 + 1.9 * (j % 16) / 15.0), (Float)(-0.95 + 1.9 * (j / 16) / 15.0));
+      Float ref = uniform.WaterSurface(pos).z;
+      err  = std::max(err,  (double)std::abs(clipmap.WaterSurface(pos).z - ref));
+      peak = std::max(peak, (double)std::abs(ref));
+    }
+    printf("clipmap %d levels of n_x = %d: %8.3f ms/step, %zu cells  uniform n_x = %d: %8.3f ms/step, %zu cells  max |height - uniform| = %g (peak %g)\n",
+           levels, clipmap.Level(0).GetSettings().n_x, lod * 1e3, clipmap.Cells(), s.n_x, full * 1e3, uniform.Amplitude().Size(), err, peak);
+  }
+
+  // A sweep of 4 wind speeds x 2 n_theta x 2 sizes, as separate grids each
+  // with its own pool and tables stepped one after the other, and as one
+  // WaveEnsemble; the members must come out the same.
+  void bench_ensemble(WaveGrid::Settings s, int steps, int threads) {
+    const Float dt = (Float)(1.0 / 60.0);
+    WaveEnsemble::Settings e;
+    e.threads = threads;
+    for (Float wind : { 5, 10, 15, 20 }) {
+      for (int n_theta : { s.n_theta, 2 * s.n_theta }) {
+        for (Float size : { s.size, 2 * s.size }) {
+          WaveGrid::Settings m  = s;
+          m.spectrum.wind_speed = wind;
+          m.n_theta             = n_theta;
+          m.size                = size;
+          m.threads             = threads;
+          e.members.push_back(m);
+        }
+      }
+    }
+    clock::time_point t0 = clock::now();
+    std::vector<std::unique_ptr<WaveGrid>> separate;
+    for (WaveGrid::Settings& m : e.members) {
+      separate.emplace_back(new WaveGrid(m));
+    }
+    double init = std::chrono::duration<double>(clock::now() - t0).count();
+    t0 = clock::now();
+    for (int i = 0; i < steps; i++) {
+      for (std::unique_ptr<WaveGrid>& grid : separate) {
+        grid->TimeStep(dt);
+      }
+    }
+    double step = std::chrono::duration<double>(clock::now() - t0).count();
+    WaveEnsemble ensemble(e);
+    for (int i = 0; i < steps; i++) {
+      ensemble.TimeStep(dt);
+    }
+    double err = 0;
+    for (int m = 0; m < ensemble.Members(); m++) {
+      for (int j = 0; j < 64; j++) {
+        Vec2 pos = e.members[m].size * Vec2((Float)(-0.9 + 1.8 * (j % 8) / 7.0), (Float)(-0.9 + 1.8 * (j / 8) / 7.0));
+        err = std::max(err, (double)std::abs(ensemble.Member(m).WaterSurface(pos).z - separate[m]->WaterSurface(pos).z));
+      }
+    }
+    double sim = (double)dt * steps * ensemble.Members();
+    printf("ensemble of %d (%d spectra, %d table sets): separate init %8.3f ms, %8.3f ms/step, %6.1f sim-s/s  ensemble init %8.3f ms, %8.3f ms/step, %6.1f sim-s/s (x%.2f)  max |height - separate| = %g\n",
+           ensemble.Members(), ensemble.Spectra(), ensemble.TableOwners(), init * 1e3, step / steps * 1e3, sim / step,
+           ensemble.InitTime() * 1e3, ensemble.StepTime() / steps * 1e3, ensemble.Throughput(), ensemble.Throughput() / (sim / step), err);
+  }
+
+  // Steps with a height-field export every step against steps alone, then
+  // maps the frames back one at a time: every frame must hold the surface
+  // of its step, the last one checked against the grid itself.
+  void bench_export(WaveGrid::Settings s, int steps) {
+    const Float       dt   = (Float)(1.0 / 60.0);
+    const std::string path = "wsw_bench_export.bin";
+    WaveGrid plain(s), grid(s);
+    clock::time_point t0 = clock::now();
+    for (int i = 0; i < steps; i++) {
+      plain.TimeStep(dt);
+    }
+    double bare = std::chrono::duration<double>(clock::now() - t0).count() / steps;
+    wsw::HeightFieldWriter::Settings e;
+    e.nx = e.ny   = 128;
+    e.half_extent = s.size;
+    std::vector<double> times;
+    double step, close;
+    {
+      wsw::HeightFieldWriter writer(path, e);
+      t0 = clock::now();
+      for (int i = 0; i < steps; i++) {
+        grid.TimeStep(dt);
+        writer.Capture(grid);
+        times.push_back((double)grid.Time());
+      }
+      step  = std::chrono::duration<double>(clock::now() - t0).count() / steps;
+      t0    = clock::now();
+      bool ok = writer.Close();
+      close = std::chrono::duration<double>(clock::now() - t0).count();
+      printf("export %d x %d: %8.3f ms/step alone, %8.3f ms/step exporting (%.3f ms sampling, %.3f ms waiting for the writer), close %.3f ms%s\n",
+             e.nx, e.ny, bare * 1e3, step * 1e3, writer.SampleTime() / steps * 1e3, writer.StallTime() / steps * 1e3, close * 1e3, ok ? "" : " FAILED");
+    }
+    wsw::HeightFieldReader reader(path);
+    bool   ordered = reader.Ok() && reader.Frames() == steps;
+    double err     = 0;
+    t0 = clock::now();
+    for (int k = steps - 1; k >= 0 && ordered; k--) {
+      std::unique_ptr<wsw::MappedFile> frame = reader.MapFrame(k);
+      const wsw::HeightFieldFrame& f = wsw::HeightFieldReader::Frame(*frame);
+      ordered = frame->Size() == reader.Header().frame_stride && f.frame == (uint64_t)k && f.time == times[k];
+    }
+    double map = std::chrono::duration<double>(clock::now() - t0).count() / std::max(steps, 1);
+    std::unique_ptr<wsw::MappedFile> last = reader.MapFrame(steps - 1);
+    for (int j = 0; ordered && j < e.nx * e.ny; j++) {
+      Vec2 pos((Float)(reader.Header().x0 + (j % e.nx) * reader.Header().dx), (Float)(reader.Header().y0 + (j / e.nx) * reader.Header().dy));
+      err = std::max(err, (double)std::abs(wsw::HeightFieldReader::Heights(*last)[j] - (float)grid.WaterSurface(pos).z));
+    }
+    printf("export read back: %d frames of %.2f MB mapped one at a time in reverse, %.3f ms/frame, %s, max |height - grid| = %g\n",
+           reader.Frames(), reader.Header().frame_stride / 1048576.0, map * 1e3, ordered ? "frames in order" : "FRAMES MISMATCH", err);
+    remove(path.c_str());
+  }
+
+  // Half a second of 60 Hz frames stepping a small grid, paced by the
+  // viewer's old spin on the clock and by FramePacer; then the pacer as fast
+  // as possible. CPU time is the process's, so it counts the spinning.
+  void bench_pacer(WaveGrid::Settings s) {
+    const double dt     = 1.0 / 60.0;
+    const int    frames = 30;
+    s.n_x     = 32;
+    s.threads = 1;
+    WaveGrid grid(s);
+    for (int variant = 0; variant < 3; variant++) {
+      FramePacer::Settings p;
+      p.dt   = dt;
+      p.mode = (variant == 2) ? FramePacer::AsFastAsPossible : FramePacer::RealTime;
+      FramePacer pacer(p);
+      int               steps = 0;
+      std::clock_t      c0    = std::clock();
+      clock::time_point t0    = clock::now();
+      for (int frame = 0; frame < frames; frame++) {
+        if (variant == 0) {
+          clock::time_point start = clock::now();
+          grid.TimeStep((Float)dt);
+          steps++;
+          while (std::chrono::duration<double>(clock::now() - start).count() < dt) {
+          }
+        } else {
+          for (int n = pacer.Advance(); n > 0; n--) {
+            grid.TimeStep((Float)dt);
+            steps++;
+          }
+          pacer.Wait();
+        }
+      }
+      double wall = std::chrono::duration<double>(clock::now() - t0).count();
+      double cpu  = (double)(std::clock() - c0) / CLOCKS_PER_SEC;
+      printf("pacing %-22s %3d steps in %6.3f s wall (%6.1f steps/s), %6.3f s CPU (%5.1f%% of a core), %6.3f s asleep\n",
+             variant == 0 ? "busy-wait" : variant == 1 ? "FramePacer real time" : "FramePacer as fast", steps, wall, steps / wall, cpu,
+             100.0 * cpu / wall, pacer.SleepTime());
+    }
+  }
+
+  // kB of the process backed by transparent huge pages, -1 where unknown
+  long long huge_page_kb() {
+    long long kb = -1;
+    if (FILE* fp = fopen("/proc/self/smaps_rollup", "r")) {
+      char line[256];
+      while (fgets(line, sizeof(line), fp)) {
+        if (!strncmp(line, "AnonHugePages:", 14)) {
+          kb = atoll(line + 14);
+        }
+      }
+      fclose(fp);
+    }
+    return kb;
+  }
+
+  // TimeStep with the amplitude buffers on huge pages and first touched per
+  // tile against the default allocation
+  void bench_pages(WaveGrid::Settings s, int steps) {
+    double ms[2];
+    std::unique_ptr<WaveGrid> grids[2];
+    for (int huge = 0; huge < 2; huge++) {
+      s.huge_pages = huge != 0;
+      long long kb = huge_page_kb();
+      grids[huge].reset(new WaveGrid(s));
+      for (int i = 0; i < steps; i++) {
+        grids[huge]->TimeStep((Float)(1.0 / 60.0));
+      }
+      const WaveGrid::Timings& t = grids[huge]->GetTimings();
+      ms[huge] = (t.fused + t.advection + t.diffusion) / steps * 1e3;
+      if (huge) {
+        long long now = huge_page_kb();
+        printf("huge pages: %8.3f ms/step  default: %8.3f ms/step (x%.2f)  %lld kB on huge pages  max |huge - default| = %g\n",
+               ms[1], ms[0], ms[0] / ms[1], (kb < 0 || now < 0) ? -1 : now - kb, (double)wsw::max_difference(grids[1]->Amplitude(), grids[0]->Amplitude()));
+      }
+    }
+  }
+
+  // Heap allocations made by TimeStep once the first steps have sized every
+  // buffer and scratch list; the steady state should make none.
+  void bench_allocations(WaveGrid::Settings s, int steps) {
+    const Float dt = (Float)(1.0 / 60.0);
+    struct Case { const char* name; Grid::Layout layout; Grid::Storage storage; bool fused, sparse; int theta_stride; Float band_courant, band_cull; };
+    const Case cases[] = {
+      { "fused",                 Grid::Linear, Grid::Full, true,  false, 1, 0, 0 },
+      { "two-pass tiled",        Grid::Tiled,  Grid::Full, false, false, 1, 0, 0 },
+      { "multi-rate + culling",  Grid::Tiled,  Grid::Full, true,  false, 1, (Float)0.25, (Float)0.01 },
+      { "sparse half + strides", Grid::Tiled,  Grid::Half, true,  true,  4, 0, 0 },
+    };
+    for (const Case& c : cases) {
+      s.layout           = c.layout;
+      s.storage          = c.storage;
+      s.fused            = c.fused;
+      s.sparse           = c.sparse;
+      s.calm_start       = c.sparse;
+      s.max_theta_stride = c.theta_stride;
+      s.band_courant       = c.band_courant;
+      s.band_cull_fraction = c.band_cull;
+      WaveGrid grid(s);
+      // a whole band period, so every band has been stepped
+      for (int i = 0; i < 2 * s.max_band_period; i++) {
+        grid.TimeStep(dt);
+      }
+      long long before = wsw::heap_allocations();
+      for (int i = 0; i < steps; i++) {
+        grid.TimeStep(dt);
+      }
+      printf("allocations %-22s %lld in %d steps (%d amplitude buffers of %.1f MB)\n", c.name, wsw::heap_allocations() - before, steps,
+             grid.Amplitude().Buffers(), grid.Amplitude().Bytes() / 1048576.0);
+    }
+    WaveClipmap::Settings c;
+    c.level     = s;
+    c.level.n_x = std::max(s.n_x / 4, 16);
+    c.levels    = 3;
+    WaveClipmap clipmap(c);
+    for (int i = 0; i < 4; i++) {
+      clipmap.TimeStep(dt);
+    }
+    long long before = wsw::heap_allocations();
+    for (int i = 0; i < steps; i++) {
+      clipmap.TimeStep(dt);
+    }
+    printf("allocations %-22s %lld in %d steps\n", "clipmap", wsw::heap_allocations() - before, steps);
+  }
+
+  std::vector<int> parse_list(const char* arg) {
+    std::vector<int> r;
+    for (const char* p = arg; *p;) {
+      char* end;
+      long  v = strtol(p, &end, 10);
+      if (end == p) {
+        return std::vector<int>();
+      }
+      r.push_back((int)v);
+      p = (*end == ',') ? end + 1 : end;
+    }
+    return r;
+  }
+
+  const char* spectrum_name(WaveGrid::Settings::SpectrumType t) {
+    switch (t) {
+    case WaveGrid::Settings::LinearBasis: return "linear_basis";
+    case WaveGrid::Settings::Jonswap:     return "jonswap";
+    case WaveGrid::Settings::TMA:         return "tma";
+    default:                              return "pierson_moskowitz";
+    }
+  }
+
+  // one phase of one scenario; `bytes` is the memory traffic of one step
+  void json_phase(FILE* out, const char* name, double seconds, double cells, double bytes, bool last) {
+    fprintf(out, "        \"%s\": { \"ms\": %.6f, \"ns_per_cell\": %.6f, \"gb_per_s\": %.6f, \"cells_per_s\": %.6e }%s\n",
+            name, seconds * 1e3, seconds / cells * 1e9, bytes / seconds * 1e-9, cells / seconds, last ? "" : ",");
+  }
+
+  // Every scenario is stepped from the same initial state with the same dt,
+  // after one warm-up step: the two-pass solver for the advection and
+  // diffusion phases, the default fused one for the fused pass, the profile
+  // tables and whole TimeStep calls.
+  void bench_matrix(FILE* out, WaveGrid::Settings s, int steps, const std::vector<int>& n_x, const std::vector<int>& n_theta,
+                    const std::vector<int>& n_zeta, const std::vector<WaveGrid::Settings::SpectrumType>& spectra) {
+    const Float dt    = (Float)(1.0 / 60.0);
+    bool        first = true;
+    fprintf(out, "{\n  \"float_bytes\": %d,\n  \"simd\": \"%s\",\n  \"threads\": %d,\n  \"layout\": \"%s\",\n  \"storage\": \"%s\",\n  \"steps\": %d,\n  \"dt\": %g,\n  \"scenarios\": [",
+            (int)sizeof(Float), wsw::simd_isa_name(s.simd == wsw::SimdAuto ? wsw::default_simd_isa() : s.simd), s.threads, layout_name(s.layout),
+            storage_name(s.storage), steps, (double)dt);
+    for (int nx : n_x) {
+      for (int nt : n_theta) {
+        for (int nz : n_zeta) {
+          for (WaveGrid::Settings::SpectrumType spectrum : spectra) {
+            s.n_x          = nx;
+            s.n_theta      = nt;
+            s.n_zeta       = nz;
+            s.spectrumType = spectrum;
+            s.fused        = false;
+            WaveGrid two_pass(s);
+            s.fused        = true;
+            WaveGrid fused(s);
+            two_pass.TimeStep(dt);
+            fused.TimeStep(dt);
+            two_pass.ResetTimings();
+            fused.ResetTimings();
+            for (int i = 0; i < steps; i++) {
+              two_pass.TimeStep(dt);
+            }
+            clock::time_point t0 = clock::now();
+            for (int i = 0; i < steps; i++) {
+              fused.TimeStep(dt);
+            }
+            double step  = std::chrono::duration<double>(clock::now() - t0).count() / steps;
+            double cells = (double)nx * nx * nt * nz;
+            double grid  = 2.0 * (double)fused.Amplitude().Bytes();
+            const WaveGrid::Timings& a = two_pass.GetTimings();
+            const WaveGrid::Timings& f = fused.GetTimings();
+            double tables = (double)f.profile_bands / steps * ProfileBuffer::DefaultResolution * sizeof(std::array<float, 4>);
+            fprintf(out, "%s\n    {\n      \"n_x\": %d, \"n_theta\": %d, \"n_zeta\": %d, \"spectrum\": \"%s\", \"cells\": %.0f, \"grid_bytes\": %zu,\n      \"phases\": {\n",
+                    first ? "" : ",", nx, nt, nz, spectrum_name(spectrum), cells, fused.Amplitude().Bytes());
+            json_phase(out, "advection", a.advection / steps, cells, grid, false);
+            json_phase(out, "diffusion", a.diffusion / steps, cells, grid, false);
+            json_phase(out, "fused",     f.fused / steps,     cells, grid, false);
+            json_phase(out, "profile",   f.profile / steps,   cells, tables, false);
+            json_phase(out, "time_step", step,                cells, grid + tables, true);
+            fprintf(out, "      }\n    }");
+            first = false;
+            fflush(out);
+          }
+        }
+      }
+    }
+    fprintf(out, "\n  ]\n}\n");
+  }
+
+  // direct evaluation of one profile row: the node constants in Float as
+  // ProfileBuffer tabulates them, sin/cos per node and the sums in double
+  std::array<double, 4> reference_profile(const Spectrum& spectrum, double time, double zeta_min, double zeta_max, double p, double period) {
+    const int nodes = 100;
+    Float dzeta = (Float)(zeta_max - zeta_min) / nodes;
+    std::array<double, 4> r = { 0, 0, 0, 0 };
+    for (int n = 0; n < nodes; n++) {
+      Float  zeta       = (Float)zeta_min + (n + (Float)0.5) * dzeta;
+      Float  wavelength = std::pow((Float)2.0, zeta);
+      double k          = wsw::tau / wavelength;
+      double omega      = wsw::dispersion_relation((Float)k, (Float)1e3);
+      double w          = dzeta * wavelength * spectrum.Exact(zeta);
+      double phases[2]  = { k * p - omega * time, k * (p - period) - omega * time };
+      double bumps[2]   = { wsw::cubic_bump((Float)(p / period)), wsw::cubic_bump((Float)(1 - p / period)) };
+      for (int t = 0; t < 2; t++) {
+        double sn = std::sin(phases[t]), c = std::cos(phases[t]);
+        r[0] += w * bumps[t] * -sn;
+        r[1] += w * bumps[t] * c;
+        r[2] += w * bumps[t] * -k * c;
+        r[3] += w * bumps[t] * -k * sn;
+      }
+    }
+    return r;
+  }
+
+  // Every spectrum type: building its table, one table lookup against its
+  // shape's pow/exp on a batch of zetas across the bands of s, and whole steps.
+  void bench_spectrum(WaveGrid::Settings s, int steps) {
+    const int n      = 4096;
+    const int rounds = steps * 10;
+    std::vector<Float> zeta(n), density(n);
+    for (int type = WaveGrid::Settings::PiersonMoskowitz; type <= WaveGrid::Settings::TMA; type++) {
+      s.spectrumType = (WaveGrid::Settings::SpectrumType)type;
+      for (int i = 0; i < n; i++) {
+        zeta[i] = s.min_zeta + (s.max_zeta - s.min_zeta) * (i + (Float)0.5) / n;
+      }
+      clock::time_point t0 = clock::now();
+      Spectrum spectrum = WaveGrid::MakeSpectrum(s);
+      double build = std::chrono::duration<double>(clock::now() - t0).count();
+      double sink  = 0;
+      t0 = clock::now();
+      for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < n; i++) {
+          density[i] = spectrum.Exact(zeta[i] + r * (Float)1e-7);
+        }
+        sink += density[r % n];
+      }
+      double exact = std::chrono::duration<double>(clock::now() - t0).count() / ((double)rounds * n);
+      t0 = clock::now();
+      for (int r = 0; r < rounds; r++) {
+        zeta[r % n] += (Float)1e-7; // keep the batch from being hoisted out of the loop
+        spectrum(zeta.data(), density.data(), n);
+        sink += density[r % n];
+      }
+      double table = std::chrono::duration<double>(clock::now() - t0).count() / ((double)rounds * n);
+      double err   = 0;
+      for (int i = 0; i < n; i++) {
+        double e = spectrum.Exact(zeta[i]);
+        err = std::max(err, std::abs(spectrum(zeta[i]) - e) / e);
+      }
+      WaveGrid grid(s);
+      for (int i = 0; i < steps; i++) {
+        grid.TimeStep((Float)(1.0 / 60.0));
+      }
+      const WaveGrid::Timings& t = grid.GetTimings();
+      printf("spectrum %-17s table %7.1f us  exact %6.2f ns  table %6.2f ns (x%.1f)  max relative error %-11g  %8.3f ms/step%s\n",
+             spectrum_name(s.spectrumType), build * 1e6, exact * 1e9, table * 1e9, exact / table, err,
+             (t.fused + t.advection + t.diffusion + t.profile) / steps * 1e3, sink < 0 ? " " : "");
+    }
+  }
+
+  void bench_profile(WaveGrid::Settings s, int steps) {
+    WaveGrid grid(s);
+    grid.ResetTimings();
+    for (int i = 0; i < steps; i++) {
+      grid.TimeStep((Float)(1.0 / 60.0));
+    }
+    const WaveGrid::Timings& t = grid.GetTimings();
+    printf("profile  %8.3f ms/step, %d bands re-evaluated per step\n", t.profile / steps * 1e3, t.profile_bands / steps);
+    // the recurrence against direct evaluation on the coarsest band
+    ProfileBuffer buffer;
+    Float zeta_max = s.min_zeta + (s.max_zeta - s.min_zeta) / s.n_zeta;
+    buffer.Precompute(grid.m_spectrum, grid.Time(), s.min_zeta, zeta_max);
+    double err = 0, peak = 0;
+    for (int i = 0; i < buffer.Resolution(); i++) {
+      double p = (double)i * buffer.Period() / buffer.Resolution();
+      std::array<double, 4> r = reference_profile(grid.m_spectrum, grid.Time(), s.min_zeta, zeta_max, p, buffer.Period());
+      for (int c = 0; c < 4; c++) {
+        err  = std::max(err,  std::abs(r[c] - buffer.data[i][c]));
+        peak = std::max(peak, std::abs(r[c]));
+      }
+    }
+    printf("profile  max |table - direct| = %g (peak %g)\n", err, peak);
+  }
+
+  // constructor cost of the profile tables: computed, then written to and read from the cache
+  void bench_cache(WaveGrid::Settings s, const char* dir) {
+    s.cache_dir.clear();
+    WaveGrid computed(s);
+    s.cache_dir = dir;
+    WaveGrid cold(s);
+    WaveGrid warm(s);
+    printf("startup  profile tables: computed %8.3f ms, cache %s %8.3f ms, cache %s %8.3f ms\n",
+           computed.ProfileStartupTime() * 1e3,
+           cold.ProfileCacheHit() ? "hit " : "miss", cold.ProfileStartupTime() * 1e3,
+           warm.ProfileCacheHit() ? "hit " : "miss", warm.ProfileStartupTime() * 1e3);
+  }
+};
+
+int main(int argc, char* argv[]) {
+  WaveGrid::Settings s;
+  s.n_x     = 400;
+  s.n_theta = 16;
+  s.fused_min_bytes = 0; // fused and two-pass are compared at every size
+  int steps   = 5;
+  int threads = (int)std::thread::hardware_concurrency();
+  const char* cache = nullptr;
+  const char* json  = nullptr;
+  std::vector<int> n_x, n_theta, n_zeta; // empty: the mode's default
+  std::vector<WaveGrid::Settings::SpectrumType> spectra = { WaveGrid::Settings::LinearBasis, WaveGrid::Settings::PiersonMoskowitz };
+  bool ok = true;
+  for (int i = 1; i < argc && ok; i++) {
+    const char* arg  = argv[i];
+    const char* next = (i + 1 < argc) ? argv[i + 1] : nullptr;
+    if      (!strcmp(arg, "--steps")    && next) { steps     = atoi(next); i++; }
+    else if (!strcmp(arg, "--n_x")      && next) { n_x       = parse_list(next); ok = !n_x.empty();     i++; }
+    else if (!strcmp(arg, "--n_theta")  && next) { n_theta   = parse_list(next); ok = !n_theta.empty(); i++; }
+    else if (!strcmp(arg, "--n_zeta")   && next) { n_zeta    = parse_list(next); ok = !n_zeta.empty();  i++; }
+    else if (!strcmp(arg, "--threads")  && next) { threads   = atoi(next); i++; }
+    else if (!strcmp(arg, "--cache")    && next) { cache     = next;       i++; }
+    else if (!strcmp(arg, "--json")     && next) { json      = next;       i++; }
+    else if (!strcmp(arg, "--spectrum") && next) {
+      bool all  = !strcmp(next, "all");
+      bool both = all || !strcmp(next, "both");
+      spectra.clear();
+      if (both || !strcmp(next, "linear"))  { spectra.push_back(WaveGrid::Settings::LinearBasis); }
+      if (both || !strcmp(next, "pm"))      { spectra.push_back(WaveGrid::Settings::PiersonMoskowitz); }
+      if (all  || !strcmp(next, "jonswap")) { spectra.push_back(WaveGrid::Settings::Jonswap); }
+      if (all  || !strcmp(next, "tma"))     { spectra.push_back(WaveGrid::Settings::TMA); }
+      ok = !spectra.empty();
+      i++;
+    }
+    else { ok = false; }
+  }
+  for (int v : n_x)     { ok = ok && v >= 2; }
+  for (int v : n_theta) { ok = ok && v >= 1; }
+  for (int v : n_zeta)  { ok = ok && v >= 1; }
+  if (!ok || steps < 1) {
+    printf("usage: %s [--steps N] [--n_x N] [--n_theta N] [--n_zeta N] [--threads N] [--cache DIR]\n"
+           "       %s --json FILE [--steps N] [--n_x N,N..] [--n_theta N,N..] [--n_zeta N,N..] [--spectrum linear|pm|jonswap|tma|both|all] [--threads N]\n", argv[0], argv[0]);
+    return 1;
+  }
+  if (json) {
+    FILE* out = strcmp(json, "-") ? fopen(json, "w") : stdout;
+    if (!out) {
+      printf("cannot write %s\n", json);
+      return 1;
+    }
+    s.threads = std::max(threads, 1);
+    bench_matrix(out, s, steps, n_x.empty() ? std::vector<int>{ 128, 256, 512 } : n_x, n_theta.empty() ? std::vector<int>{ 8, 16 } : n_theta,
+                 n_zeta.empty() ? std::vector<int>{ 1, 4 } : n_zeta, spectra);
+    if (out != stdout) {
+      fclose(out);
+    }
+    return 0;
+  }
+  // the text report runs on the first value of every list
+  s.n_x     = n_x.empty()     ? s.n_x     : n_x[0];
+  s.n_theta = n_theta.empty() ? s.n_theta : n_theta[0];
+  s.n_zeta  = n_zeta.empty()  ? s.n_zeta  : n_zeta[0];
+  printf("grid layout: n_x = %d, n_theta = %d, n_zeta = %d, %d steps\n", s.n_x, s.n_theta, s.n_zeta, steps);
+  bench_access(s, Grid::Linear, steps * 4);
+  bench_access(s, Grid::Tiled,  steps * 4);
+  bench_layout(s, Grid::Linear, steps);
+  bench_layout(s, Grid::Tiled,  steps);
+  bench_simd(s, steps);
+  bench_profile(s, steps);
+  bench_spectrum(s, steps);
+  if (cache) {
+    bench_cache(s, cache);
+  }
+  bench_threads(s, steps, std::max(threads, 1));
+  for (int layout = Grid::Linear; layout <= Grid::Tiled; layout++) {
+    WaveGrid::Settings f = s;
+    f.n_zeta = std::max(s.n_zeta, 4);
+    f.layout = (Grid::Layout)layout;
+    printf("%-7s n_zeta = %d: ", layout_name(f.layout), f.n_zeta);
+    bench_fused(f, steps);
+  }
+  for (int layout = Grid::Linear; layout <= Grid::Tiled; layout++) {
+    for (int fused = 0; fused <= 1; fused++) {
+      WaveGrid::Settings f = s;
+      f.layout = (Grid::Layout)layout;
+      f.fused  = fused != 0;
+      printf("%-7s %-8s ", layout_name(f.layout), f.fused ? "fused" : "two-pass");
+      bench_shift(f, steps);
+    }
+  }
+  for (int layout = Grid::Linear; layout <= Grid::Tiled; layout++) {
+    for (int fused = 0; fused <= 1; fused++) {
+      WaveGrid::Settings f = s;
+      f.layout = (Grid::Layout)layout;
+      f.fused  = fused != 0;
+      bench_stencils(f, steps);
+    }
+  }
+  WaveGrid::Settings multi = s;
+  multi.n_zeta = std::max(s.n_zeta, 4);
+  bench_bands(multi, steps * 8, (Float)(1.0 / 60.0), (Float)0.25, (Float)1e-3);
+  bench_bands(multi, steps * 8, (Float)0.5, (Float)0.5, (Float)0.05);
+  // substeps keep the long steps of a large dt stable, which stepping every
+  // band once per call is not, so there is no reference to hold them to and
+  // they cost more than the single step they replace
+  multi.max_band_substeps = 16;
+  bench_bands(multi, steps * 8, (Float)0.5, (Float)0.5, 0);
+  multi.max_band_substeps = s.max_band_substeps;
+  for (int layout = Grid::Linear; layout <= Grid::Tiled; layout++) {
+    multi.layout = (Grid::Layout)layout;
+    bench_resolution(multi, steps);
+  }
+  multi.layout = s.layout;
+  multi.n_zeta = std::max(s.n_zeta, 8);
+  bench_culling(multi, steps);
+  bench_sparse(s, steps);
+  bench_storage(s, steps);
+  bench_theta(s, steps);
+  WaveGrid::Settings lod = s;
+  lod.n_x = std::max(s.n_x / 4, 16);
+  bench_lod(lod, steps, 3);
+  bench_ensemble(lod, steps, threads);
+  bench_export(s, steps);
+  bench_pacer(s);
+  bench_allocations(s, steps);
+  bench_pages(s, steps);
+  return 0;
+}
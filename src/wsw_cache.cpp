@@ -0,0 +1,222 @@
+#include "wsw_cache.h"
+#include <cstdio>
+#include <cstring>
+
+#if defined(WIN32) || defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace wsw {
+
+namespace {
+  const char     magic[8] = { 'W', 'S', 'W', 'P', 'R', 'O', 'F', '\0' };
+  const uint32_t version  = 2;
+
+  struct Header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t float_size;
+    uint64_t key;
+    uint32_t bands;
+    uint32_t nodes;
+    uint32_t resolution;
+    uint32_t reserved;
+  };
+
+  // creates dir and any missing parent; true if it exists afterwards
+  bool make_directories(const std::string& dir) {
+    if (dir.empty()) {
+      return true;
+    }
+    size_t slash = dir.find_last_of("/\\");
+    if (slash != std::string::npos && slash > 0 && !make_directories(dir.substr(0, slash))) {
+      return false;
+    }
+#if defined(WIN32) || defined(_WIN32)
+    return CreateDirectoryA(dir.c_str(), nullptr) || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+    struct stat st;
+    return mkdir(dir.c_str(), 0777) == 0 || (stat(dir.c_str(), &st) == 0 && S_ISDIR(st.st_mode));
+#endif
+  }
+
+  size_t band_size(uint32_t nodes, uint32_t resolution) {
+    return 2 * sizeof(double) + 3 * sizeof(double) * nodes + sizeof(std::array<float, 4>) * resolution;
+  }
+
+  // FNV-1a
+  struct Hash {
+    uint64_t h = 14695981039346656037ull;
+    void bytes(const void* p, size_t n) {
+      for (size_t i = 0; i < n; i++) {
+        h = (h ^ ((const unsigned char*)p)[i]) * 1099511628211ull;
+      }
+    }
+    template <class T> void operator()(const T& v) { bytes(&v, sizeof(v)); }
+  };
+};
+
+uint64_t profile_cache_key(const WaveGrid::Settings& s, const Spectrum& spectrum) {
+  Hash h;
+  h(version);
+  h((uint32_t)sizeof(Float));
+  h((int32_t)ProfileBuffer::DefaultResolution);
+  h((int32_t)ProfileBuffer::DefaultPeriodicity);
+  h((int32_t)ProfileBuffer::DefaultNodes);
+  h((int32_t)s.n_zeta);
+  h(s.min_zeta);
+  h(s.max_zeta);
+  h(s.initial_time);
+  h((int32_t)s.spectrumType);
+  h.bytes(spectrum.Table().data(), spectrum.Table().size() * sizeof(Float)); // shape and parameters
+  return h.h;
+}
+
+std::string profile_cache_path(const std::string& dir, uint64_t key) {
+  char name[64];
+  snprintf(name, sizeof(name), "profile-%016llx.bin", (unsigned long long)key);
+  if (dir.empty()) {
+    return name;
+  }
+  char last = dir[dir.size() - 1];
+  return (last == '/' || last == '\\') ? dir + name : dir + "/" + name;
+}
+
+bool load_profile_cache(const std::string& path, uint64_t key, std::vector<ProfileBuffer>& buffers) {
+  MappedFile file(path);
+  if (file.Size() < sizeof(Header)) {
+    return false;
+  }
+  Header h;
+  memcpy(&h, file.Data(), sizeof(h));
+  if (memcmp(h.magic, magic, sizeof(magic)) != 0 || h.version != version || h.float_size != sizeof(Float) ||
+      h.key != key || h.bands != buffers.size() || file.Size() != sizeof(Header) + h.bands * band_size(h.nodes, h.resolution)) {
+    return false;
+  }
+  // copied out of the mapping: each buffer owns its table, which Evaluate
+  // rewrites as the grid steps
+  const unsigned char* p = file.Data() + sizeof(Header);
+  for (ProfileBuffer& buffer : buffers) {
+    const double* d = (const double*)p; // every field is 8 byte aligned in the file
+    buffer.Restore((Float)d[0], (Float)d[1], (int)h.nodes, d + 2, d + 2 + h.nodes, d + 2 + 2 * h.nodes,
+                   (int)h.resolution, (const std::array<float, 4>*)(d + 2 + 3 * h.nodes));
+    p += band_size(h.nodes, h.resolution);
+  }
+  return true;
+}
+
+bool save_profile_cache(const std::string& path, uint64_t key, const std::vector<ProfileBuffer>& buffers) {
+  if (buffers.empty()) {
+    return false;
+  }
+  Header h;
+  memcpy(h.magic, magic, sizeof(magic));
+  h.version    = version;
+  h.float_size = sizeof(Float);
+  h.key        = key;
+  h.bands      = (uint32_t)buffers.size();
+  h.nodes      = (uint32_t)buffers[0].Weights().size();
+  h.resolution = (uint32_t)buffers[0].Resolution();
+  h.reserved   = 0;
+  // write a sibling and rename it into place, so a concurrent reader never
+  // maps a half written file
+  char suffix[32];
+#if defined(WIN32) || defined(_WIN32)
+  snprintf(suffix, sizeof(suffix), ".%lu.tmp", (unsigned long)GetCurrentProcessId());
+#else
+  snprintf(suffix, sizeof(suffix), ".%ld.tmp", (long)getpid());
+#endif
+  std::string tmp   = path + suffix;
+  size_t      slash = path.find_last_of("/\\");
+  if (slash != std::string::npos && !make_directories(path.substr(0, slash))) {
+    return false;
+  }
+  FILE* fp = fopen(tmp.c_str(), "wb");
+  if (!fp) {
+    return false;
+  }
+  bool ok = fwrite(&h, sizeof(h), 1, fp) == 1;
+  for (const ProfileBuffer& buffer : buffers) {
+    if (buffer.Weights().size() != h.nodes || buffer.Resolution() != (int)h.resolution) {
+      ok = false;
+      break;
+    }
+    double head[2] = { (double)buffer.Period(), (double)buffer.Time() };
+    ok = ok && fwrite(head, sizeof(head), 1, fp) == 1;
+    ok = ok && fwrite(buffer.Wavenumbers().data(), sizeof(double), h.nodes, fp) == h.nodes;
+    ok = ok && fwrite(buffer.Omegas().data(),      sizeof(double), h.nodes, fp) == h.nodes;
+    ok = ok && fwrite(buffer.Weights().data(),     sizeof(double), h.nodes, fp) == h.nodes;
+    ok = ok && fwrite(buffer.data.data(), sizeof(buffer.data[0]), h.resolution, fp) == h.resolution;
+  }
+  ok = (fclose(fp) == 0) && ok;
+#if defined(WIN32) || defined(_WIN32)
+  ok = ok && MoveFileExA(tmp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+  ok = ok && rename(tmp.c_str(), path.c_str()) == 0;
+#endif
+  if (!ok) {
+    remove(tmp.c_str());
+  }
+  return ok;
+}
+
+#if defined(WIN32) || defined(_WIN32)
+MappedFile::MappedFile(const std::string& path) : MappedFile(path, 0, 0) {
+}
+
+// size 0: to the end of the file
+MappedFile::MappedFile(const std::string& path, uint64_t offset, size_t bytes) : m_data(nullptr), m_size(0), m_handle(nullptr) {
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return;
+  }
+  LARGE_INTEGER size;
+  if (GetFileSizeEx(file, &size) && (uint64_t)size.QuadPart > offset && (uint64_t)size.QuadPart - offset >= bytes) {
+    bytes    = bytes ? bytes : (size_t)((uint64_t)size.QuadPart - offset);
+    m_handle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_handle) {
+      m_data = (const unsigned char*)MapViewOfFile(m_handle, FILE_MAP_READ, (DWORD)(offset >> 32), (DWORD)offset, bytes);
+      m_size = m_data ? bytes : 0;
+    }
+  }
+  CloseHandle(file);
+}
+
+MappedFile::~MappedFile() {
+  if (m_data)   { UnmapViewOfFile(m_data); }
+  if (m_handle) { CloseHandle(m_handle); }
+}
+#else
+MappedFile::MappedFile(const std::string& path) : MappedFile(path, 0, 0) {
+}
+
+// size 0: to the end of the file
+MappedFile::MappedFile(const std::string& path, uint64_t offset, size_t bytes) : m_data(nullptr), m_size(0), m_handle(nullptr) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == 0 && (uint64_t)st.st_size > offset && (uint64_t)st.st_size - offset >= bytes) {
+    bytes   = bytes ? bytes : (size_t)((uint64_t)st.st_size - offset);
+    void* p = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, (off_t)offset);
+    if (p != MAP_FAILED) {
+      m_data = (const unsigned char*)p;
+      m_size = bytes;
+    }
+  }
+  close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (m_data) { munmap((void*)m_data, m_size); }
+}
+#endif
+
+}
@@ -0,0 +1,45 @@
+#ifndef WSW_CACHE_H
+#define WSW_CACHE_H
+
+// Content-addressed on-disk cache of the startup profile tables.
+//
+// A cache file holds the integration nodes and the evaluated table of every
+// band for one key, in a flat little-endian layout that is read through a
+// read-only memory map:
+//   header   | magic "WSWPROF", version, sizeof(Float), key, bands, nodes, resolution
+//   per band | period, time (double), nodes x (wavenumber, omega, weight) (double),
+//            | resolution x float4
+
+#include "wsw_core.h"
+#include <string>
+
+namespace wsw {
+  // hash of everything the startup tables depend on
+  uint64_t profile_cache_key(const WaveGrid::Settings& s, const Spectrum& spectrum);
+  // <dir>/profile-<key>.bin
+  std::string profile_cache_path(const std::string& dir, uint64_t key);
+  // false if the file is missing, truncated, of another version or key
+  bool load_profile_cache(const std::string& path, uint64_t key, std::vector<ProfileBuffer>& buffers);
+  // creates the directory of `path` if missing; false if nothing was written
+  bool save_profile_cache(const std::string& path, uint64_t key, const std::vector<ProfileBuffer>& buffers);
+
+  // read-only memory map of a whole file, or of `size` bytes at `offset`
+  // (a multiple of MapGranularity); empty if the file is shorter
+  class MappedFile {
+  public:
+    static const size_t MapGranularity = 65536; // of mapping offsets on every platform
+    explicit MappedFile(const std::string& path);
+    MappedFile(const std::string& path, uint64_t offset, size_t size);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    const unsigned char* Data() const { return m_data; }
+    size_t               Size() const { return m_size; }
+  private:
+    const unsigned char* m_data;
+    size_t               m_size;
+    void*                m_handle; // file mapping object on Windows
+  };
+}
+
+#endif // WSW_CACHE_H
@@ -0,0 +1,66 @@
+#ifndef WSW_COMPARE_H
+#define WSW_COMPARE_H
+
+// Differences between two grids stepped with different settings, shared
+// by wsw_bench and wsw_tests.
+
+#include "wsw_core.h"
+#include <algorithm>
+#include <cmath>
+
+namespace wsw {
+  // the largest |a - b| over every cell; both must have the same band sizes
+  inline Float max_difference(const Grid& a, const Grid& b) {
+    Float d = 0;
+    for (int izeta = 0; izeta < a.Dimension(Grid::Zeta); izeta++) {
+      for (int itheta = 0; itheta < a.Dimension(Grid::Theta); itheta++) {
+        for (int iy = 0; iy < a.GetBand(izeta).n_y; iy++) {
+          for (int ix = 0; ix < a.GetBand(izeta).n_x; ix++) {
+            d = std::max(d, std::abs(a(ix, iy, itheta, izeta) - b(ix, iy, itheta, izeta)));
+          }
+        }
+      }
+    }
+    return d;
+  }
+
+  // the largest |height - reference height| over 8 x 8 points across the
+  // domain; peak is the largest |reference height| among them
+  inline double height_difference(const WaveGrid& grid, const WaveGrid& reference, double& peak) {
+    const WaveGrid::Settings& s = reference.GetSettings();
+    double d = 0;
+    peak = 0;
+    for (int j = 0; j < 64; j++) {
+      Vec2  pos = Vec2(s.size * (Float)(-0.9 + 1.8 * (j % 8) / 7.0), s.size * (Float)(-0.9 + 1.8 * (j / 8) / 7.0));
+      Float ref = reference.WaterSurface(pos).z;
+      d    = std::max(d, (double)std::abs(grid.WaterSurface(pos).z - ref));
+      peak = std::max(peak, (double)std::abs(ref));
+    }
+    return d;
+  }
+
+  // the largest |amplitude - reference amplitude| on the nodes within
+  // `nodes` of their band's spacing from the shore and on the others, and
+  // the largest |reference amplitude|
+  struct ShoreDifference {
+    Float shore = 0;
+    Float open  = 0;
+    Float peak  = 0;
+  };
+  inline ShoreDifference shore_difference(const WaveGrid& grid, const WaveGrid& reference, Float nodes) {
+    ShoreDifference r;
+    const Grid& a = reference.Amplitude();
+    a.ForEachCell<Grid::Linear>([&](int ix, int iy, int itheta, int izeta) {
+      Float ref  = a(ix, iy, itheta, izeta);
+      Float d    = std::abs(grid.Amplitude()(ix, iy, itheta, izeta) - ref);
+      Float dx   = reference.m_enviroment._dx * (Float)(1 << a.GetBand(izeta).shift);
+      bool  near = reference.m_enviroment.Levelset(reference.NodePosition(ix, iy, izeta)) <= nodes * dx;
+      r.peak  = std::max(r.peak, std::abs(ref));
+      r.shore = near ? std::max(r.shore, d) : r.shore;
+      r.open  = near ? r.open : std::max(r.open, d);
+    });
+    return r;
+  }
+}
+
+#endif
@@ -0,0 +1,1296 @@
+#include "wsw_core.h"
+#include "wsw_simd.h"
+#include "wsw_thread_pool.h"
+#include "wsw_cache.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <limits>
+#if defined(WIN32) || defined(_WIN32)
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace {
+  typedef std::chrono::steady_clock clock;
+  double seconds_since(clock::time_point t0) {
+    return std::chrono::duration<double>(clock::now() - t0).count();
+  }
+
+  // halo-padded amplitudes of one zeta band around a tile, x fastest;
+  // indexed with grid coordinates like a GridAccessor
+  struct ScratchView {
+    Float* data;
+    int    x0, y0, w, h;
+    Float& operator()(int ix, int iy, int itheta, int) const {
+      return data[((size_t)itheta * h + (iy - y0)) * w + (ix - x0)];
+    }
+  };
+
+  // a grid's runtime layout and storage as template arguments
+  template <Grid::Layout L, class S>
+  struct Format {
+    static const Grid::Layout layout = L;
+    typedef S Storage;
+  };
+  // calls fn(Format<layout, storage>()) for the format of g
+  template <class Fn>
+  auto dispatch(const Grid& g, const Fn& fn) -> decltype(fn(Format<Grid::Linear, wsw::FloatStorage>())) {
+    bool tiled = g.GetLayout() == Grid::Tiled;
+    switch (g.GetStorage()) {
+    case Grid::Half:
+      return tiled ? fn(Format<Grid::Tiled, wsw::HalfStorage>())     : fn(Format<Grid::Linear, wsw::HalfStorage>());
+    case Grid::BFloat16:
+      return tiled ? fn(Format<Grid::Tiled, wsw::BFloat16Storage>()) : fn(Format<Grid::Linear, wsw::BFloat16Storage>());
+    default:
+      return tiled ? fn(Format<Grid::Tiled, wsw::FloatStorage>())    : fn(Format<Grid::Linear, wsw::FloatStorage>());
+    }
+  }
+};
+
+void* wsw::aligned_alloc_bytes(size_t bytes, size_t align) {
+#if defined(WIN32) || defined(_WIN32)
+  return _aligned_malloc(std::max(bytes, (size_t)1), align);
+#else
+  void* p = nullptr;
+  return (posix_memalign(&p, align, std::max(bytes, (size_t)1)) == 0) ? p : nullptr;
+#endif
+}
+
+void* wsw::huge_alloc_bytes(size_t bytes) {
+  bytes = (bytes + HugePageSize - 1) & ~(HugePageSize - 1);
+  void* p = aligned_alloc_bytes(bytes, HugePageSize);
+#if defined(MADV_HUGEPAGE)
+  if (p) {
+    madvise(p, bytes, MADV_HUGEPAGE); // only advice: without THP these stay small pages
+  }
+#endif
+  return p;
+}
+
+void wsw::aligned_free(void* p) {
+#if defined(WIN32) || defined(_WIN32)
+  _aligned_free(p);
+#else
+  free(p);
+#endif
+}
+
+std::array<float, 4> ProfileBuffer::operator()(Float p) const {
+  int   n = (int)data.size();
+  Float x = p / m_period * n;
+  x -= std::floor(x / n) * n;
+  int   i0 = std::min((int)x, n - 1);
+  int   i1 = (i0 + 1) % n;
+  float w  = (float)(x - i0);
+  std::array<float, 4> r;
+  for (int c = 0; c < 4; c++) {
+    r[c] = (1.0f - w) * data[i0][c] + w * data[i1][c];
+  }
+  return r;
+}
+
+// Each integration node contributes w * (b1(p) g(k p - w t) + b2(p) g(k (p - P) - w t))
+// to row p. Along the rows both phases advance by the constant k dp, so the
+// sines and cosines are carried by a rotation recurrence in double instead of
+// being evaluated per row, and the node loop is a plain multiply-add over
+// arrays that the compiler vectorizes.
+void ProfileBuffer::Evaluate(Float time, int begin, int end) {
+  const int block = 64;
+  int       n     = (int)m_weight.size();
+  double    P     = m_period;
+  double    dp    = P / Resolution();
+  for (int i = begin; i < end; i++) {
+    data[i] = std::array<float, 4>{ 0.0f, 0.0f, 0.0f, 0.0f };
+  }
+  for (int n0 = 0; n0 < n; n0 += block) {
+    int    nb = std::min(block, n - n0);
+    double c1[block], s1[block], c2[block], s2[block], rc[block], rs[block];
+    const double* k = &m_wavenumber[n0];
+    const double* w = &m_weight[n0];
+    for (int j = 0; j < nb; j++) {
+      double phase1 = k[j] * (begin * dp) - m_omega[n0 + j] * time;
+      double phase2 = phase1 - k[j] * P;
+      c1[j] = std::cos(phase1);
+      s1[j] = std::sin(phase1);
+      c2[j] = std::cos(phase2);
+      s2[j] = std::sin(phase2);
+      rc[j] = std::cos(k[j] * dp);
+      rs[j] = std::sin(k[j] * dp);
+    }
+    for (int i = begin; i < end; i++) {
+      double b1 = wsw::cubic_bump((Float)(i * dp / P));
+      double b2 = wsw::cubic_bump((Float)(1.0 - i * dp / P));
+      double d0 = 0, d1 = 0, d2 = 0, d3 = 0;
+      for (int j = 0; j < nb; j++) {
+        double a1 = w[j] * b1, a2 = w[j] * b2;
+        double c  = a1 * c1[j] + a2 * c2[j];
+        double sn = a1 * s1[j] + a2 * s2[j];
+        d0 -= sn;
+        d1 += c;
+        d2 -= k[j] * c;
+        d3 -= k[j] * sn;
+        double t1 = c1[j] * rc[j] - s1[j] * rs[j];
+        double t2 = c2[j] * rc[j] - s2[j] * rs[j];
+        s1[j] = s1[j] * rc[j] + c1[j] * rs[j];
+        s2[j] = s2[j] * rc[j] + c2[j] * rs[j];
+        c1[j] = t1;
+        c2[j] = t2;
+      }
+      data[i][0] += (float)d0;
+      data[i][1] += (float)d1;
+      data[i][2] += (float)d2;
+      data[i][3] += (float)d3;
+    }
+  }
+}
+
+// the nodes' phases drift apart, so over time their cross terms average out
+double ProfileBuffer::MeanSquare() const {
+  double sum = 0;
+  for (double w : m_weight) {
+    sum += w * w;
+  }
+  return sum;
+}
+
+WaveGrid::WaveGrid(Settings& s) : WaveGrid(s, MakeSpectrum(s), nullptr) {
+}
+
+WaveGrid::WaveGrid(Settings& s, const Spectrum& spectrum, const WaveGrid* tables, ThreadPool* pool)
+  : m_spectrum(spectrum), m_enviroment(s.size, s.n_x, s.center, s.scene_size), m_settings(s), m_pool(pool), m_outer(nullptr), m_tables(tables), m_lendsTables(false), m_time(s.initial_time) {
+  for (int itheta = 0; itheta < s.n_theta; itheta++) {
+    Float t = Theta(itheta);
+    m_directions.push_back(Vec2(std::cos(t), std::sin(t)));
+    m_ambient.push_back((std::cos(t) > (Float)0.0) ? (Float)0.5 * std::cos(t) * std::cos(t) : (Float)0.0);
+  }
+  m_simd      = (s.simd == wsw::SimdAuto) ? wsw::default_simd_isa() : std::min(s.simd, wsw::best_simd_isa());
+  m_advectRow = wsw::advect_row_kernel(m_simd);
+  if (!m_pool) {
+    m_ownPool.reset(new ThreadPool(s.threads));
+    m_pool = m_ownPool.get();
+  }
+  m_slowLanes.assign(m_pool->Size(), std::vector<unsigned char>(s.n_x));
+  m_settings.tile_size = std::max(s.tile_size, 1);
+  m_settings.cached_stencils = s.cached_stencils && s.n_x < Stencil::Backtrace; // node indices are 16 bit
+  m_tilesX = (s.n_x + m_settings.tile_size - 1) / m_settings.tile_size;
+  m_tileStride.assign(tile_count(), 1);
+  // coarsen each band while its spacing stays within band_spacing wavelengths
+  // and its nodes still tile the domain and every tile exactly
+  std::vector<int> shifts(s.n_zeta, 0);
+  for (int izeta = 0; izeta < s.n_zeta && s.band_spacing > (Float)0.0; izeta++) {
+    Float wavelength = std::pow((Float)2.0, Zeta(izeta));
+    for (int c = 2; c <= s.max_band_coarsening && s.n_x % c == 0 && m_settings.tile_size % c == 0 && s.n_x / c >= 2 &&
+                    c * m_enviroment._dx <= s.band_spacing * wavelength; c *= 2) {
+      shifts[izeta]++;
+    }
+  }
+  if (s.huge_pages) {
+    // each tile's pages are first written by the worker whose share of a
+    // dense pass starts on that tile, see ThreadPool::ParallelFor
+    m_amplitude.Allocate(s.n_x, s.n_x, s.n_theta, s.n_zeta, s.layout, s.storage, 2, true, shifts);
+    for (int b = 0; b < m_amplitude.Buffers(); b++) {
+      m_pool->ParallelFor(tile_count(), [&](int t, int) {
+        dispatch(m_amplitude, [&](auto f) { this->clear_kernel<decltype(f)::layout, typename decltype(f)::Storage>(tile(t)); });
+      });
+      m_amplitude.Flip();
+    }
+  } else {
+    m_amplitude.Resize(s.n_x, s.n_x, s.n_theta, s.n_zeta, s.layout, 0, s.storage, 2, shifts);
+  }
+  m_settings.fused = s.fused && m_amplitude.Bytes() >= s.fused_min_bytes;
+  size_t padded = (size_t)std::min(m_settings.tile_size + 2, s.n_x);
+  m_scratch.assign(m_pool->Size(), std::vector<Float>(padded * padded * s.n_theta));
+  m_shiftRows.assign(m_pool->Size(), std::vector<Float>(2 * padded));
+  m_sliceDone.assign(m_pool->Size(), std::vector<unsigned char>((size_t)s.n_zeta * s.n_theta));
+  m_shiftedCells.assign(m_pool->Size(), 0);
+  m_bandNodes.resize(s.n_zeta);
+  size_t nodes = 0;
+  for (int izeta = 0; izeta < s.n_zeta; izeta++) {
+    m_bandNodes[izeta] = nodes;
+    nodes += (size_t)band_n(izeta) * band_n(izeta);
+  }
+  m_groupSpeed.resize(nodes);
+  m_levelset.resize(nodes);
+  m_bandSpeed.assign(s.n_zeta, (Float)0.0);
+  m_maxGroupSpeed = 0;
+  for (int izeta = 0; izeta < s.n_zeta; izeta++) {
+    Float k = Wavenumber(izeta);
+    for (int iy = 0; iy < band_n(izeta); iy++) {
+      for (int ix = 0; ix < band_n(izeta); ix++) {
+        Float h = m_enviroment.Depth(NodePosition(ix, iy, izeta));
+        m_levelset[band_node(ix, iy, izeta)]   = m_enviroment.Levelset(NodePosition(ix, iy, izeta));
+        m_groupSpeed[band_node(ix, iy, izeta)] = (h > (Float)0.0) ? wsw::group_speed(k, h) : (Float)0.0;
+        m_bandSpeed[izeta] = std::max(m_bandSpeed[izeta], m_groupSpeed[band_node(ix, iy, izeta)]);
+      }
+    }
+    m_maxGroupSpeed = std::max(m_maxGroupSpeed, m_bandSpeed[izeta]);
+  }
+  m_bandDt.assign(s.n_zeta, (Float)0.0);
+  m_bandStep.assign(s.n_zeta, (Float)0.0);
+  m_bandSubsteps.assign(s.n_zeta, 0);
+  m_bandLag.assign(s.n_zeta, (Float)0.0);
+  m_bandCalls.assign(s.n_zeta, 0);
+  m_bandSeconds.assign((size_t)m_pool->Size() * s.n_zeta, 0.0);
+  m_bandTimings.assign(s.n_zeta, BandTimings());
+  m_tileEnergy.assign((size_t)tile_count() * s.n_zeta, 0.0);
+  m_energyStale = true;
+  m_stencilDt.assign(s.n_zeta, (Float)0.0);
+  // start from the ambient sea state everywhere in the water
+  for (int izeta = 0; izeta < s.n_zeta; izeta++) {
+    for (int itheta = 0; itheta < s.n_theta; itheta++) {
+      Float a = s.calm_start ? (Float)0.0 : ambient_amplitude(itheta, izeta);
+      for (int iy = 0; iy < band_n(izeta); iy++) {
+        for (int ix = 0; ix < band_n(izeta); ix++) {
+          bool wet = m_levelset[band_node(ix, iy, izeta)] >= (Float)0.0;
+          m_amplitude.Set(ix, iy, itheta, izeta, wet ? a : (Float)0.0);
+        }
+      }
+    }
+  }
+  m_tileTasks.reserve(tile_count());
+  m_tileClears.reserve(tile_count());
+  m_tileAmplitude.resize(tile_count());
+  m_tileQuiet.assign(tile_count(), 0);
+  m_tileDetail.assign(tile_count(), (Float)1.0);
+  m_tileShore.assign(tile_count(), 0);
+  for (int iy = 0; iy < s.n_x; iy++) {
+    for (int ix = 0; ix < s.n_x; ix++) {
+      int t = (iy / m_settings.tile_size) * m_tilesX + ix / m_settings.tile_size;
+      m_tileShore[t] |= m_enviroment.Levelset(NodePosition(ix, iy)) < m_settings.tile_size * m_enviroment._dx;
+    }
+  }
+  // over the tile and the halo fused_kernel advects with it; band tiles
+  // under MinShiftSide a side are never shifted, and a grid in which no tile
+  // can be leaves the shift off altogether
+  m_tileSpeed.assign((size_t)tile_count() * s.n_zeta, (Float)-1.0);
+  m_tileLevelset.assign((size_t)tile_count() * s.n_zeta, std::numeric_limits<Float>::max());
+  for (int t = 0; t < tile_count(); t++) {
+    for (int izeta = 0; izeta < s.n_zeta; izeta++) {
+      Tile   h       = halo(band_tile(tile(t), izeta), izeta);
+      size_t i       = (size_t)t * s.n_zeta + izeta;
+      Float  c       = GroupSpeed(h.x0, h.y0, izeta);
+      bool   uniform = true;
+      for (int iy = h.y0; iy < h.y1; iy++) {
+        for (int ix = h.x0; ix < h.x1; ix++) {
+          m_tileLevelset[i] = std::min(m_tileLevelset[i], m_levelset[band_node(ix, iy, izeta)]);
+          uniform           = uniform && GroupSpeed(ix, iy, izeta) == c;
+        }
+      }
+      Tile b = band_tile(tile(t), izeta);
+      m_tileSpeed[i] = (uniform && b.x1 - b.x0 >= MinShiftSide && b.y1 - b.y0 >= MinShiftSide) ? c : (Float)-1.0;
+    }
+  }
+  bool shiftable = false;
+  for (size_t i = 0; i < m_tileSpeed.size(); i++) {
+    shiftable = shiftable || (m_tileSpeed[i] >= (Float)0.0 && m_tileLevelset[i] > (Float)0.0);
+  }
+  m_settings.uniform_shift = s.uniform_shift && shiftable;
+  for (int t = 0; t < tile_count(); t++) {
+    m_tileTasks.push_back(t);
+    m_tileAmplitude[t] = dispatch(m_amplitude, [&](auto f) {
+      typedef decltype(f) F;
+      return this->tile_amplitude<F::layout, typename F::Storage>(m_amplitude.ConstView<F::layout, typename F::Storage>(), tile(t));
+    });
+  }
+  m_staleBands.reserve(s.n_zeta);
+  m_profileStartup  = 0.0;
+  m_profileCacheHit   = false;
+  m_profileCacheSaved = false;
+  if (m_tables) {
+    return;
+  }
+  m_profileBuffers.resize(s.n_zeta);
+  clock::time_point t0 = clock::now();
+  uint64_t    key  = wsw::profile_cache_key(m_settings, m_spectrum);
+  std::string path = wsw::profile_cache_path(s.cache_dir, key);
+  m_profileCacheHit = !s.cache_dir.empty() && wsw::load_profile_cache(path, key, m_profileBuffers);
+  if (!m_profileCacheHit) {
+    set_spectrum();
+    precompute_profile_buffer();
+    if (!s.cache_dir.empty()) {
+      m_profileCacheSaved = wsw::save_profile_cache(path, key, m_profileBuffers);
+    }
+  }
+  m_profileStartup = seconds_since(t0);
+}
+
+WaveGrid::~WaveGrid() {
+}
+
+void WaveGrid::TimeStep(Float dt) {
+  m_time += dt;
+  if (m_settings.band_cull_fraction > (Float)0.0 && (m_energyStale || m_timings.steps % EnergyInterval == 0)) {
+    clock::time_point t = clock::now();
+    measure_band_energy();
+    m_timings.energy += seconds_since(t);
+  }
+  int passes = schedule_bands(dt);
+  for (int pass = 0; pass < passes; pass++) {
+    Float             pass_dt = band_pass(pass, passes);
+    clock::time_point t       = clock::now();
+    bool              stale   = false;
+    for (int izeta = 0; izeta < m_settings.n_zeta; izeta++) {
+      stale = stale || (m_bandDt[izeta] > (Float)0.0 && m_bandDt[izeta] != m_stencilDt[izeta]);
+    }
+    if (m_settings.cached_stencils && stale) {
+      build_stencils();
+      m_timings.stencils += seconds_since(t);
+      t = clock::now();
+    }
+    schedule_tiles(pass_dt, m_settings.fused ? 1 : 2);
+    if (m_settings.fused) {
+      fused_step();
+      m_timings.fused     += seconds_since(t);
+    } else {
+      advection_step();
+      m_timings.advection += seconds_since(t);
+      t = clock::now();
+      diffusion_step();
+      m_timings.diffusion += seconds_since(t);
+    }
+  }
+  if (!m_tables) {
+    clock::time_point t = clock::now();
+    precompute_profile_buffer();
+    m_timings.profile += seconds_since(t);
+  }
+  for (long long& cells : m_shiftedCells) {
+    m_timings.shifted += cells;
+    cells = 0;
+  }
+  for (size_t i = 0; i < m_bandSeconds.size(); i++) {
+    m_bandTimings[i % m_settings.n_zeta].seconds += m_bandSeconds[i];
+    m_bandSeconds[i] = 0.0;
+  }
+  m_timings.steps++;
+}
+
+// Picks each band's rate for a TimeStep of dt: a power of two substeps, or
+// a step every power of two calls by the time gathered since the last one,
+// so the bands stay in step at the calls their periods divide. Returns the
+// passes this call takes, the most substeps of any band stepped (0: none).
+int WaveGrid::schedule_bands(Float dt) {
+  const Settings& s      = m_settings;
+  int             passes = 0;
+  for (int izeta = 0; izeta < s.n_zeta; izeta++) {
+    BandTimings& b       = m_bandTimings[izeta];
+    Float        courant = m_bandSpeed[izeta] * dt / band_dx(izeta);
+    b.substeps = 1;
+    b.period   = 1;
+    if (s.band_courant > (Float)0.0) {
+      while (b.substeps < s.max_band_substeps && courant > b.substeps * s.band_courant) {
+        b.substeps *= 2;
+      }
+      while (b.substeps == 1 && 2 * b.period <= s.max_band_period && 2 * b.period * courant <= s.band_courant) {
+        b.period *= 2;
+      }
+    }
+    m_bandSubsteps[izeta] = 0;
+    if (!b.live) {
+      continue; // nor gathers time: it resumes where it was frozen
+    }
+    b.live_calls++;
+    m_bandLag[izeta] += dt;
+    if (++m_bandCalls[izeta] >= b.period) {
+      m_bandSubsteps[izeta] = b.substeps;
+      m_bandStep[izeta]     = m_bandLag[izeta] / b.substeps;
+      m_bandLag[izeta]      = 0;
+      m_bandCalls[izeta]    = 0;
+      b.steps += b.substeps;
+      passes   = std::max(passes, b.substeps);
+    }
+  }
+  return passes;
+}
+
+// Each band's share of the surface energy, the time-averaged mean square of
+// its profile x the mean over its nodes of the squared amplitudes, and the
+// same share of what enters through the boundary decide whether it is live,
+// see Settings::band_cull_fraction. The profile's weight only changes with
+// SetSpectrum, so the decision does not follow the nodes' interference from
+// step to step, and the tables, which an ensemble member may be rewriting,
+// are not read. The tiles are summed in order, so the result does not depend
+// on the thread count. Until either total is measured nothing is suspended.
+void WaveGrid::measure_band_energy() {
+  const Settings& s = m_settings;
+  m_pool->ParallelFor(tile_count(), [&](int t, int) {
+    dispatch(m_amplitude, [&](auto f) { this->band_energy_kernel<decltype(f)::layout, typename decltype(f)::Storage>(tile(t), &m_tileEnergy[(size_t)t * s.n_zeta]); });
+  });
+  double total = 0, total_inflow = 0;
+  for (int izeta = 0; izeta < s.n_zeta; izeta++) {
+    BandTimings& b      = m_bandTimings[izeta];
+    double       weight = ProfileBuffers()[izeta].MeanSquare();
+    double       energy = 0;
+    for (int t = 0; t < tile_count(); t++) {
+      energy += m_tileEnergy[(size_t)t * s.n_zeta + izeta];
+    }
+    b.share      = weight * energy / ((double)band_n(izeta) * band_n(izeta));
+    b.inflow     = weight * inflow_energy(izeta);
+    total        += b.share;
+    total_inflow += b.inflow;
+  }
+  for (int izeta = 0; izeta < s.n_zeta; izeta++) {
+    BandTimings& b = m_bandTimings[izeta];
+    b.share  = (total > 0.0) ? b.share / total : 0.0;
+    b.inflow = (total_inflow > 0.0) ? b.inflow / total_inflow : 0.0;
+    double top = std::max(b.share, b.inflow);
+    if (total <= 0.0 && total_inflow <= 0.0) {
+      b.live = true;
+    } else if (b.live && top < s.band_cull_fraction) {
+      b.live = false;
+    } else if (!b.live && top >= 2 * s.band_cull_fraction) {
+      b.live = true;
+    }
+  }
+  m_energyStale = false;
+}
+
+// summed squared amplitude of every band over tile t, into energy[izeta]
+template <Grid::Layout L, class S>
+void WaveGrid::band_energy_kernel(const Tile& t, double* energy) {
+  GridAccessor<L, const Float, S> a = m_amplitude.ConstView<L, S>();
+  for (int izeta = 0; izeta < m_settings.n_zeta; izeta++) {
+    double sum[4] = { 0, 0, 0, 0 }; // by the fastest index, so the adds need not wait on each other
+    m_amplitude.ForEachCell<L>(t.x0, t.y0, t.x1, t.y1, izeta, izeta + 1, [&](int ix, int iy, int itheta, int izeta) {
+      Float v = a(ix, iy, itheta, izeta);
+      sum[((L == Grid::Tiled) ? itheta : ix) & 3] += (double)v * v;
+    });
+    energy[izeta] = sum[0] + sum[1] + sum[2] + sum[3];
+  }
+}
+
+// mean over the nodes just outside the domain of the squared amplitude band
+// izeta enters with, summed over the directions heading inwards
+double WaveGrid::inflow_energy(int izeta) const {
+  const Settings& s      = m_settings;
+  int             n      = band_n(izeta);
+  const Vec2      in[4]  = { Vec2(1, 0), Vec2(-1, 0), Vec2(0, 1), Vec2(0, -1) };
+  double          energy = 0;
+  for (int i = 0; i < n; i++) {
+    Vec2 pos[4] = { NodePosition(-1, i, izeta), NodePosition(n, i, izeta), NodePosition(i, -1, izeta), NodePosition(i, n, izeta) };
+    for (int edge = 0; edge < 4; edge++) {
+      for (int itheta = 0; itheta < s.n_theta; itheta++) {
+        if (glm::dot(WaveDirection(itheta), in[edge]) <= (Float)0.0) { continue; }
+        Float a = m_outer ? m_outer->AmplitudeAt(pos[edge] + s.center, (Float)itheta, izeta) : ambient_amplitude(itheta, izeta);
+        energy += (double)a * a;
+      }
+    }
+  }
+  return energy / (4.0 * n);
+}
+
+// Sets the dt of every band for pass `pass` of `passes`: a band of n
+// substeps takes one at the end of each passes / n of them, so all end the
+// call at the same time. Returns the largest.
+Float WaveGrid::band_pass(int pass, int passes) {
+  Float largest = 0;
+  for (int izeta = 0; izeta < m_settings.n_zeta; izeta++) {
+    int  n      = m_bandSubsteps[izeta];
+    bool active = n > 0 && (pass + 1) % (passes / n) == 0;
+    m_bandDt[izeta] = active ? m_bandStep[izeta] : (Float)0.0;
+    largest         = std::max(largest, m_bandDt[izeta]);
+  }
+  return largest;
+}
+
+Vec2 WaveGrid::NodePosition(int ix, int iy) const {
+  Float dx = m_enviroment._dx;
+  return Vec2(-m_settings.size + (ix + (Float)0.5) * dx, -m_settings.size + (iy + (Float)0.5) * dx);
+}
+
+Vec2 WaveGrid::NodePosition(int ix, int iy, int izeta) const {
+  Float dx = band_dx(izeta);
+  return Vec2(-m_settings.size + (ix + (Float)0.5) * dx, -m_settings.size + (iy + (Float)0.5) * dx);
+}
+
+Float WaveGrid::Theta(int itheta) const {
+  return (itheta + (Float)0.5) * wsw::tau / m_settings.n_theta;
+}
+
+Float WaveGrid::Zeta(int izeta) const {
+  Float dzeta = (m_settings.max_zeta - m_settings.min_zeta) / m_settings.n_zeta;
+  return m_settings.min_zeta + (izeta + (Float)0.5) * dzeta;
+}
+
+Float WaveGrid::Wavenumber(int izeta) const {
+  return wsw::tau / std::pow((Float)2.0, Zeta(izeta));
+}
+
+// waves entering through the domain boundary: cos^2 spreading around the wind direction (+x)
+// tabulated in the constructor, so boundary forcing is a fetch
+Float WaveGrid::ambient_amplitude(int itheta, int) const {
+  return m_ambient[itheta];
+}
+
+// the bilinear corners and weights of pos (clamped to the nodes of band
+// izeta) and of the fractional direction itheta (periodic)
+WaveGrid::Bilinear WaveGrid::bilinear(Vec2 pos, Float itheta, int izeta) const {
+  int      n  = band_n(izeta);
+  int      nt = m_settings.n_theta;
+  Float    fx = (pos.x + m_settings.size) / band_dx(izeta) - (Float)0.5;
+  Float    fy = (pos.y + m_settings.size) / band_dx(izeta) - (Float)0.5;
+  Bilinear b;
+  fx    = glm::clamp(fx, (Float)0.0, (Float)(n - 1));
+  fy    = glm::clamp(fy, (Float)0.0, (Float)(n - 1));
+  b.ix0 = std::min((int)fx, n - 2);
+  b.iy0 = std::min((int)fy, n - 2);
+  b.wx  = fx - b.ix0;
+  b.wy  = fy - b.iy0;
+  Float ft = itheta - std::floor(itheta / nt) * nt;
+  b.it0 = std::min((int)ft, nt - 1);
+  b.it1 = (b.it0 + 1) % nt;
+  b.wt  = ft - b.it0;
+  return b;
+}
+
+// the corners and weights of node (ix, iy)'s backtrace along its own
+// direction, in nodes: the offset's floor and fraction are both exact, so
+// the nodes of a slice with one group speed get the weights of its uniform
+// shift bit for bit. Clamped to the nodes of the band like bilinear()
+WaveGrid::Bilinear WaveGrid::traced_bilinear(int ix, int iy, int itheta, int izeta, Float dt) const {
+  int      n   = band_n(izeta);
+  Vec2     dir = WaveDirection(itheta);
+  Float    c   = GroupSpeed(ix, iy, izeta);
+  Float    fx  = -dt * c * dir.x / band_dx(izeta);
+  Float    fy  = -dt * c * dir.y / band_dx(izeta);
+  Bilinear b;
+  b.ix0 = ix + (int)std::floor(fx);
+  b.iy0 = iy + (int)std::floor(fy);
+  b.wx  = (b.ix0 < 0) ? (Float)0.0 : (b.ix0 > n - 2) ? (Float)1.0 : fx - std::floor(fx);
+  b.wy  = (b.iy0 < 0) ? (Float)0.0 : (b.iy0 > n - 2) ? (Float)1.0 : fy - std::floor(fy);
+  b.ix0 = glm::clamp(b.ix0, 0, n - 2);
+  b.iy0 = glm::clamp(b.iy0, 0, n - 2);
+  b.it0 = itheta;
+  b.it1 = (itheta + 1) % m_settings.n_theta;
+  b.wt  = 0;
+  return b;
+}
+
+template <class A>
+Float WaveGrid::interpolated_amplitude(const A& a, const Bilinear& b, int izeta) const {
+  Float r = 0;
+  int   its[2] = { b.it0, b.it1 };
+  Float wts[2] = { 1 - b.wt, b.wt };
+  for (int t = 0; t < 2; t++) {
+    if (wts[t] == (Float)0.0) { continue; }
+    Float v = (1 - b.wy) * ((1 - b.wx) * a(b.ix0, b.iy0,     its[t], izeta) + b.wx * a(b.ix0 + 1, b.iy0,     its[t], izeta))
+            +      b.wy  * ((1 - b.wx) * a(b.ix0, b.iy0 + 1, its[t], izeta) + b.wx * a(b.ix0 + 1, b.iy0 + 1, its[t], izeta));
+    r += wts[t] * v;
+  }
+  return r;
+}
+
+// Semi-Lagrangian backtrace along the group velocity, reflecting off the
+// shore: where the amplitude of the node comes from. Water and Reflected
+// set the source position and the (for a reflection, fractional) direction
+// to read; Water is read through traced_bilinear.
+WaveGrid::Departure WaveGrid::departure(int ix, int iy, int itheta, int izeta, Float dt, Vec2& src, Float& theta) const {
+  Vec2 pos = NodePosition(ix, iy, izeta);
+  if (m_levelset[band_node(ix, iy, izeta)] < (Float)0.0) {
+    return Land;
+  }
+  Vec2 dir = WaveDirection(itheta);
+  src   = pos - dt * GroupSpeed(ix, iy, izeta) * dir;
+  theta = (Float)itheta;
+  if (!m_enviroment.InDomain(src)) {
+    return Outside;
+  }
+  Float ls = m_enviroment.Levelset(src);
+  if (ls < (Float)0.0) {
+    Vec2 n    = m_enviroment.LevelsetGradient(src);
+    src      -= 2 * ls * n;
+    Vec2 rdir = dir - 2 * glm::dot(dir, n) * n;
+    theta     = std::atan2(rdir.y, rdir.x) * m_settings.n_theta / wsw::tau - (Float)0.5;
+    return Reflected;
+  }
+  return Water;
+}
+
+template <class A>
+Float WaveGrid::advected_amplitude(const A& a, int ix, int iy, int itheta, int izeta, Float dt) const {
+  Vec2  src;
+  Float theta;
+  switch (departure(ix, iy, itheta, izeta, dt, src, theta)) {
+  case Land:    return (Float)0.0;
+  case Outside: return m_outer ? m_outer->AmplitudeAt(src + m_settings.center, (Float)itheta, izeta) : ambient_amplitude(itheta, izeta);
+  case Water:   return interpolated_amplitude(a, traced_bilinear(ix, iy, itheta, izeta, dt), izeta);
+  default:      return interpolated_amplitude(a, src, theta, izeta);
+  }
+}
+
+WaveGrid::Tile WaveGrid::tile(int t) const {
+  int  n    = m_settings.n_x;
+  int  size = m_settings.tile_size;
+  int  tx   = t % m_tilesX;
+  int  ty   = t / m_tilesX;
+  Tile r    = { tx * size, ty * size, std::min((tx + 1) * size, n), std::min((ty + 1) * size, n), m_tileStride[t] };
+  return r;
+}
+
+template <Grid::Layout L, class S>
+Float WaveGrid::tile_amplitude(const GridAccessor<L, const Float, S>& a, const Tile& t) const {
+  Float sum = 0;
+  m_amplitude.ForEachCell<L>(t.x0, t.y0, t.x1, t.y1, [&](int ix, int iy, int itheta, int izeta) {
+    Float v = a(ix, iy, itheta, izeta);
+    sum += std::abs(v);
+  });
+  return sum;
+}
+
+// zeros the back buffer of the bands that flip next, and both of the
+// others, which no pass reads or writes until they flip again
+template <Grid::Layout L, class S>
+void WaveGrid::clear_kernel(const Tile& t) {
+  GridAccessor<L, Float, S> front = m_amplitude.View<L, S>();
+  GridAccessor<L, Float, S> back  = m_amplitude.BackView<L, S>();
+  for (int izeta = 0; izeta < m_settings.n_zeta; izeta++) {
+    bool flips = m_amplitude.Flips(izeta);
+    m_amplitude.ForEachCell<L>(t.x0, t.y0, t.x1, t.y1, izeta, izeta + 1, [&](int ix, int iy, int itheta, int izeta) {
+      back(ix, iy, itheta, izeta) = (Float)0.0;
+      if (!flips) {
+        front(ix, iy, itheta, izeta) = (Float)0.0;
+      }
+    });
+  }
+}
+
+// RMS error of linearly interpolating the directions at odd multiples of the
+// tile's stride from their neighbours, relative to the tile's peak amplitude:
+// what doubling the stride would lose.
+template <Grid::Layout L, class S>
+Float WaveGrid::theta_detail(const GridAccessor<L, const Float, S>& a, const Tile& t) const {
+  int nt   = m_settings.n_theta;
+  int step = t.stride;
+  if (nt % (2 * step) != 0) {
+    return (Float)0.0;
+  }
+  double detail = 0, peak = 0;
+  long long odd = 0;
+  m_amplitude.ForEachCell<L>(t.x0, t.y0, t.x1, t.y1, [&](int ix, int iy, int itheta, int izeta) {
+    if (itheta % step != 0) { return; }
+    Float v = a(ix, iy, itheta, izeta);
+    peak = std::max(peak, (double)std::abs(v));
+    if ((itheta / step) & 1) {
+      Float lo = a(ix, iy, itheta - step, izeta);
+      Float hi = a(ix, iy, (itheta + step) % nt, izeta);
+      Float d  = v - (Float)0.5 * (lo + hi);
+      detail += (double)d * d;
+      odd++;
+    }
+  });
+  return (peak > 0.0) ? (Float)(std::sqrt(detail / odd) / peak) : (Float)0.0;
+}
+
+// interpolates the directions a tile with a theta stride did not step, periodically in theta
+template <Grid::Layout L, class S>
+void WaveGrid::fill_thetas(const Tile& t, int izeta) {
+  GridAccessor<L, Float, S> dst  = m_amplitude.BackView<L, S>();
+  int                       nt   = m_settings.n_theta;
+  int                       step = t.stride;
+  m_amplitude.ForEachCell<L>(t.x0, t.y0, t.x1, t.y1, izeta, izeta + 1, [&](int ix, int iy, int itheta, int izeta) {
+    int r = itheta % step;
+    if (r == 0) { return; }
+    Float w  = (Float)r / step;
+    Float lo = dst(ix, iy, itheta - r, izeta);
+    Float hi = dst(ix, iy, (itheta - r + step) % nt, izeta);
+    dst(ix, iy, itheta, izeta) = (1 - w) * lo + w * hi;
+  });
+}
+
+// Picks the tiles to step and their theta strides. A tile coarsens its
+// directions while the ones it would drop are interpolated well, down to
+// four directions, and refines as soon as the ones it keeps are not.
+void WaveGrid::schedule_tiles(Float dt, int passes) {
+  const Settings& s = m_settings;
+  m_tileTasks.clear();
+  m_tileClears.clear();
+  for (int t = 0; t < tile_count() && s.max_theta_stride > 1; t++) {
+    int coarser = 2 * m_tileStride[t];
+    if (m_tileShore[t]) {
+      m_tileStride[t] = 1;
+    } else if (m_tileDetail[t] < s.theta_tolerance && coarser <= s.max_theta_stride && s.n_theta % coarser == 0 && s.n_theta / coarser >= 4) {
+      m_tileStride[t] = coarser;
+    } else if (m_tileDetail[t] > 4 * s.theta_tolerance && m_tileStride[t] > 1) {
+      m_tileStride[t] /= 2;
+    }
+  }
+  if (!s.sparse) {
+    for (int t = 0; t < tile_count(); t++) {
+      m_tileTasks.push_back(t);
+    }
+  } else {
+    schedule_active_tiles(dt, passes);
+  }
+  m_timings.tiles += (long long)m_tileTasks.size();
+  for (int t : m_tileTasks) {
+    for (int izeta = 0; izeta < s.n_zeta; izeta++) {
+      Tile r = band_tile(tile(t), izeta);
+      m_timings.cells += (m_bandDt[izeta] > (Float)0.0) ? (long long)(r.x1 - r.x0) * (r.y1 - r.y0) * (s.n_theta / r.stride) : 0;
+    }
+  }
+}
+
+// A step moves amplitude by at most c dt upstream and a shore reflection by
+// as much again, plus the bilinear and diffusion stencils (a node of the
+// coarsest band apart), so a tile is woken when any tile (or the domain
+// boundary, which feeds in the ambient sea state) within that reach is
+// active. A skipped tile is cleared until both buffers hold zeros, i.e. for
+// two passes.
+void WaveGrid::schedule_active_tiles(Float dt, int passes) {
+  const Settings& s      = m_settings;
+  int             spread = 1;
+  for (int izeta = 0; izeta < s.n_zeta; izeta++) {
+    spread = std::max(spread, 1 << band_shift(izeta));
+  }
+  Float reach  = 3 * m_maxGroupSpeed * dt / m_enviroment._dx + 2 * spread;
+  int   radius = (int)std::ceil(reach / s.tile_size);
+  for (int ty = 0; ty < m_tilesX; ty++) {
+    for (int tx = 0; tx < m_tilesX; tx++) {
+      bool wake = false;
+      for (int y = ty - radius; y <= ty + radius && !wake; y++) {
+        for (int x = tx - radius; x <= tx + radius && !wake; x++) {
+          bool outside = x < 0 || y < 0 || x >= m_tilesX || y >= m_tilesX;
+          wake = outside || m_tileAmplitude[y * m_tilesX + x] > s.calm_threshold;
+        }
+      }
+      int t = ty * m_tilesX + tx;
+      if (wake) {
+        m_tileTasks.push_back(t);
+        m_tileQuiet[t] = 0;
+        continue;
+      }
+      if (m_tileQuiet[t] < 2) {
+        m_tileClears.push_back(t);
+      }
+      m_tileQuiet[t]     = (unsigned char)std::min(m_tileQuiet[t] + passes, 2);
+      m_tileAmplitude[t] = 0;
+    }
+  }
+}
+
+// Runs fn(tile, izeta, dt, worker) over the bands stepped this pass (see
+// band_pass) of the scheduled tiles and clears the skipped tiles on the
+// pool, then flips the amplitude buffers of the stepped bands only: the
+// others keep theirs in front without a copy. Tiles with a theta stride get
+// the other directions of the stepped bands interpolated. With `measure`
+// (the last pass of a step) the stepped tiles' summed amplitude and angular
+// detail are refreshed for the next schedule.
+template <Grid::Layout L, class S, class Fn>
+void WaveGrid::run_tiles(bool measure, const Fn& fn) {
+  int n = (int)m_tileTasks.size();
+  for (int izeta = 0; izeta < m_settings.n_zeta; izeta++) {
+    m_amplitude.SetFlip(izeta, m_bandDt[izeta] > (Float)0.0);
+  }
+  m_pool->ParallelFor(n + (int)m_tileClears.size(), [&](int task, int worker) {
+    if (task >= n) {
+      clear_kernel<L, S>(tile(m_tileClears[task - n]));
+      return;
+    }
+    Tile t = tile(m_tileTasks[task]);
+    for (int izeta = 0; izeta < m_settings.n_zeta; izeta++) {
+      clock::time_point start = clock::now();
+      if (m_bandDt[izeta] > (Float)0.0) {
+        fn(t, izeta, m_bandDt[izeta], worker);
+        if (t.stride > 1) {
+          fill_thetas<L, S>(t, izeta);
+        }
+      }
+      m_bandSeconds[(size_t)worker * m_settings.n_zeta + izeta] += seconds_since(start);
+    }
+    if (measure && m_settings.sparse) {
+      m_tileAmplitude[m_tileTasks[task]] = tile_amplitude<L, S>(m_amplitude.ConstNextView<L, S>(), t);
+    }
+    if (measure && m_settings.max_theta_stride > 1 && m_timings.steps % DetailInterval == 0) {
+      m_tileDetail[m_tileTasks[task]] = theta_detail<L, S>(m_amplitude.ConstNextView<L, S>(), t);
+    }
+  });
+  m_amplitude.Flip();
+}
+
+// Where the group speed is the same at every node of region r (in tile t,
+// in the nodes of band izeta) and no source lies on land, within a step of
+// the shore or outside the nodes, every backtrace of slice (itheta, izeta)
+// ends the same fraction of a node away: the slice moves as a whole, by `shift`.
+bool WaveGrid::uniform_shift(const Tile& r, int t, int itheta, int izeta, Float dt, Shift& shift) const {
+  const Settings& s = m_settings;
+  Float           c = m_tileSpeed[(size_t)t * s.n_zeta + izeta];
+  if (!s.uniform_shift || c < (Float)0.0 || !(m_tileLevelset[(size_t)t * s.n_zeta + izeta] > dt * c)) {
+    return false;
+  }
+  int   n   = band_n(izeta);
+  Vec2  dir = WaveDirection(itheta);
+  Float fx  = -dt * c * dir.x / band_dx(izeta);
+  Float fy  = -dt * c * dir.y / band_dx(izeta);
+  shift.ox  = (int)std::floor(fx);
+  shift.oy  = (int)std::floor(fy);
+  shift.wx  = fx - shift.ox;
+  shift.wy  = fy - shift.oy;
+  return r.x0 + shift.ox >= 0 && r.x1 + shift.ox < n && r.y0 + shift.oy >= 0 && r.y1 + shift.oy < n;
+}
+
+// The bilinear backtrace of a uniform shift, separated: each source row is
+// filtered along x once into `rows` (2 x width), and every output row blends
+// the last two, so a node costs two multiply-adds and no coordinates.
+template <class A, class B>
+void WaveGrid::shift_slice(const A& src, const B& dst, const Tile& r, int itheta, int izeta, const Shift& shift, Float* rows) const {
+  int    w  = r.x1 - r.x0;
+  Float* lo = rows;
+  Float* hi = rows + w;
+  auto filter = [&](int iy, Float* out) {
+    int x = r.x0 + shift.ox;
+    for (int i = 0; i < w; i++) {
+      out[i] = (1 - shift.wx) * src(x + i, iy, itheta, izeta) + shift.wx * src(x + i + 1, iy, itheta, izeta);
+    }
+  };
+  filter(r.y0 + shift.oy, lo);
+  for (int iy = r.y0; iy < r.y1; iy++) {
+    filter(iy + shift.oy + 1, hi);
+    for (int i = 0; i < w; i++) {
+      dst(r.x0 + i, iy, itheta, izeta) = (1 - shift.wy) * lo[i] + shift.wy * hi[i];
+    }
+    std::swap(lo, hi);
+  }
+}
+
+// Resolves every backtrace the uniform shift does not cover into a Stencil,
+// per tile over the region fused_kernel advects (the tile and its halo); the
+// two-pass kernels read the tile's part of it. Only the terrain and the
+// band's dt go into a stencil, so they hold until that dt changes. The bands
+// stepped this pass get stencils for their dt, the others keep theirs.
+void WaveGrid::build_stencils() {
+  const Settings& s     = m_settings;
+  size_t          total = 0;
+  for (int izeta = 0; izeta < s.n_zeta; izeta++) {
+    m_stencilDt[izeta] = (m_bandDt[izeta] > (Float)0.0) ? m_bandDt[izeta] : m_stencilDt[izeta];
+  }
+  m_stencilSlices.resize((size_t)tile_count() * s.n_zeta * s.n_theta);
+  for (int t = 0; t < tile_count(); t++) {
+    for (int izeta = 0; izeta < s.n_zeta; izeta++) {
+      Tile h = halo(band_tile(tile(t), izeta), izeta);
+      for (int itheta = 0; itheta < s.n_theta; itheta++) {
+        Shift   shift;
+        size_t& offset = m_stencilSlices[((size_t)t * s.n_zeta + izeta) * s.n_theta + itheta];
+        bool    none   = m_stencilDt[izeta] == (Float)0.0 || uniform_shift(h, t, itheta, izeta, m_stencilDt[izeta], shift);
+        offset = none ? NoStencils : total;
+        total += none ? 0 : (size_t)(h.x1 - h.x0) * (h.y1 - h.y0);
+      }
+    }
+  }
+  m_stencils.resize(total);
+  m_pool->ParallelFor(tile_count(), [&](int t, int) {
+    for (int izeta = 0; izeta < s.n_zeta; izeta++) {
+      Tile  h  = halo(band_tile(tile(t), izeta), izeta);
+      Float dt = m_stencilDt[izeta];
+      for (int itheta = 0; itheta < s.n_theta; itheta++) {
+        size_t offset = m_stencilSlices[((size_t)t * s.n_zeta + izeta) * s.n_theta + itheta];
+        if (offset == NoStencils) {
+          continue;
+        }
+        Stencil* out = &m_stencils[offset];
+        for (int iy = h.y0; iy < h.y1; iy++) {
+          for (int ix = h.x0; ix < h.x1; ix++, out++) {
+            Vec2      src;
+            Float     theta;
+            Departure d = departure(ix, iy, itheta, izeta, dt, src, theta);
+            *out = Stencil{ (d == Land) ? Stencil::Land : Stencil::Backtrace, 0, 0, 0, 0, 0 };
+            if (d == Water || d == Reflected) {
+              Bilinear b = (d == Water) ? traced_bilinear(ix, iy, itheta, izeta, dt) : bilinear(src, theta, izeta);
+              *out = Stencil{ (uint16_t)b.ix0, (uint16_t)b.iy0, (uint16_t)b.it0, b.wx, b.wy, b.wt };
+            }
+          }
+        }
+      }
+    }
+  });
+  m_timings.stencil_builds++;
+}
+
+// the stencils of slice (itheta, izeta) of tile t over its halo, nullptr if it has none
+const WaveGrid::Stencil* WaveGrid::slice_stencils(int t, int itheta, int izeta) const {
+  if (!m_settings.cached_stencils || m_stencilSlices.empty()) {
+    return nullptr;
+  }
+  size_t offset = m_stencilSlices[((size_t)t * m_settings.n_zeta + izeta) * m_settings.n_theta + itheta];
+  return (offset == NoStencils) ? nullptr : &m_stencils[offset];
+}
+
+// advected_amplitude of node (ix, iy) from its stencil: a gather and a blend,
+// no geometry. Boundary nodes are still traced, their inflow changes between steps.
+template <class A>
+Float WaveGrid::replayed_amplitude(const A& src, const Stencil& c, int ix, int iy, int itheta, int izeta, Float dt) const {
+  if (c.x >= Stencil::Backtrace) {
+    return (c.x == Stencil::Land) ? (Float)0.0 : advected_amplitude(src, ix, iy, itheta, izeta, dt);
+  }
+  Float wx = c.wx, wy = c.wy;
+  Float v  = (1 - wy) * ((1 - wx) * src(c.x, c.y,     c.theta, izeta) + wx * src(c.x + 1, c.y,     c.theta, izeta))
+           +      wy  * ((1 - wx) * src(c.x, c.y + 1, c.theta, izeta) + wx * src(c.x + 1, c.y + 1, c.theta, izeta));
+  if (c.wt != (Float)0.0) { // a reflection between two directions
+    int   t1 = (c.theta + 1) % m_settings.n_theta;
+    Float wt = c.wt;
+    Float v1 = (1 - wy) * ((1 - wx) * src(c.x, c.y,     t1, izeta) + wx * src(c.x + 1, c.y,     t1, izeta))
+             +      wy  * ((1 - wx) * src(c.x, c.y + 1, t1, izeta) + wx * src(c.x + 1, c.y + 1, t1, izeta));
+    v = (1 - wt) * v + wt * v1;
+  }
+  return v;
+}
+
+// the nodes of r from the stencils of slice (itheta, izeta) over h
+template <class A, class B>
+void WaveGrid::replay_slice(const A& src, const B& dst, const Tile& r, const Tile& h, int itheta, int izeta,
+                            const Stencil* stencils, Float dt) const {
+  for (int iy = r.y0; iy < r.y1; iy++) {
+    const Stencil* row = stencils + (size_t)(iy - h.y0) * (h.x1 - h.x0) + (r.x0 - h.x0);
+    for (int ix = r.x0; ix < r.x1; ix++) {
+      dst(ix, iy, itheta, izeta) = replayed_amplitude(src, row[ix - r.x0], ix, iy, itheta, izeta, dt);
+    }
+  }
+}
+
+// the uniformly shifted and replayed slices of band izeta first, then the others in storage order
+template <Grid::Layout L, class S>
+void WaveGrid::advection_kernel(const Tile& t, int izeta, Float dt, int worker) {
+  const Settings&                 s    = m_settings;
+  GridAccessor<L, const Float, S> src  = m_amplitude.ConstView<L, S>();
+  GridAccessor<L, Float, S>       dst  = m_amplitude.BackView<L, S>();
+  unsigned char*                  done = m_sliceDone[worker].data();
+  Tile                            b    = band_tile(t, izeta);
+  Shift                           shift;
+  for (int itheta = 0; itheta < s.n_theta; itheta += t.stride) {
+    bool           shifted  = uniform_shift(b, tile_index(t), itheta, izeta, dt, shift);
+    const Stencil* stencils = shifted ? nullptr : slice_stencils(tile_index(t), itheta, izeta);
+    if (shifted) {
+      shift_slice(src, dst, b, itheta, izeta, shift, m_shiftRows[worker].data());
+      m_shiftedCells[worker] += (long long)(b.x1 - b.x0) * (b.y1 - b.y0);
+    } else if (stencils) {
+      replay_slice(src, dst, b, halo(b, izeta), itheta, izeta, stencils, dt);
+    }
+    done[itheta] = shifted || stencils;
+  }
+  m_amplitude.ForEachCell<L>(t.x0, t.y0, t.x1, t.y1, izeta, izeta + 1, [&](int ix, int iy, int itheta, int izeta) {
+    if (itheta % t.stride == 0 && !done[itheta]) {
+      dst(ix, iy, itheta, izeta) = advected_amplitude(src, ix, iy, itheta, izeta, dt);
+    }
+  });
+}
+
+// one row segment through the vectorized kernel; nodes near the shore fall
+// back to the scalar reflecting backtrace, or to their stencils (from row.begin) if cached
+void WaveGrid::advect_row(const GridAccessor<Grid::Linear, const Float>& src, wsw::AdvectRow& row,
+                          int iy, int itheta, int izeta, Float dt, Float* out, unsigned char* slow, const Stencil* stencils) const {
+  row.speed    = &m_groupSpeed[band_node(0, iy, izeta)];
+  row.levelset = &m_levelset[band_node(0, iy, izeta)];
+  row.iy       = iy;
+  row.y        = NodePosition(0, iy, izeta).y;
+  m_advectRow(row, out, slow);
+  for (int ix = row.begin; ix < row.end; ix++) {
+    if (slow[ix - row.begin]) {
+      out[ix - row.begin] = stencils ? replayed_amplitude(src, stencils[ix - row.begin], ix, iy, itheta, izeta, dt)
+                                     : advected_amplitude(src, ix, iy, itheta, izeta, dt);
+    }
+  }
+}
+
+// the AdvectRow fields shared by every row of slice (itheta, izeta)
+void WaveGrid::advect_slice(const GridAccessor<Grid::Linear, const Float>& src, wsw::AdvectRow& row,
+                            int x0, int x1, int itheta, int izeta, Float dt) const {
+  Vec2 dir    = WaveDirection(itheta);
+  row.n       = band_n(izeta);
+  row.begin   = x0;
+  row.end     = x1;
+  row.size    = m_settings.size;
+  row.dx      = band_dx(izeta);
+  row.dt      = dt;
+  row.slice   = &src(0, 0, itheta, izeta);
+  row.dir_x   = dir.x;
+  row.dir_y   = dir.y;
+  row.ambient = ambient_amplitude(itheta, izeta);
+  row.outside = m_outer ? ~0u : 0u;
+}
+
+void WaveGrid::advection_simd(const Tile& t, int izeta, Float dt, int worker) {
+  const Settings&                         s    = m_settings;
+  GridAccessor<Grid::Linear, const Float> src  = m_amplitude.ConstView<Grid::Linear>();
+  GridAccessor<Grid::Linear, Float>       dst  = m_amplitude.BackView<Grid::Linear>();
+  unsigned char*                          slow = m_slowLanes[worker].data();
+  Tile           b = band_tile(t, izeta);
+  Shift          shift;
+  wsw::AdvectRow row;
+  for (int itheta = 0; itheta < s.n_theta; itheta += t.stride) {
+    if (uniform_shift(b, tile_index(t), itheta, izeta, dt, shift)) {
+      shift_slice(src, dst, b, itheta, izeta, shift, m_shiftRows[worker].data());
+      m_shiftedCells[worker] += (long long)(b.x1 - b.x0) * (b.y1 - b.y0);
+      continue;
+    }
+    // the vector kernel is faster than the stencils except where it falls back
+    const Stencil* stencils = slice_stencils(tile_index(t), itheta, izeta);
+    Tile           h        = halo(b, izeta);
+    advect_slice(src, row, b.x0, b.x1, itheta, izeta, dt);
+    for (int iy = b.y0; iy < b.y1; iy++) {
+      advect_row(src, row, iy, itheta, izeta, dt, &dst(b.x0, iy, itheta, izeta), slow,
+                 stencils ? stencils + (size_t)(iy - h.y0) * (h.x1 - h.x0) + (b.x0 - h.x0) : nullptr);
+    }
+  }
+}
+
+// Every tile reads only the front buffer of m_amplitude and writes only its
+// own nodes of the back one, so the halo of a tile is simply the shared source grid and
+// the pool's barrier at the end of the pass is the exchange.
+template <Grid::Layout L, class S>
+void WaveGrid::advection_pass() {
+  run_tiles<L, S>(false, [&](const Tile& t, int izeta, Float dt, int worker) {
+    if (L == Grid::Linear && std::is_same<S, wsw::FloatStorage>::value && m_advectRow) {
+      advection_simd(t, izeta, dt, worker);
+    } else {
+      advection_kernel<L, S>(t, izeta, dt, worker);
+    }
+  });
+}
+
+void WaveGrid::advection_step() {
+  dispatch(m_amplitude, [&](auto f) { this->advection_pass<decltype(f)::layout, typename decltype(f)::Storage>(); });
+}
+
+// angular diffusion plus dispersion along the propagation direction; with a
+// theta stride the angular Laplacian spans `stride` directions
+template <class A>
+Float WaveGrid::diffused_amplitude(const A& a, int ix, int iy, int itheta, int izeta, Float dt, int stride) const {
+  const Settings& s  = m_settings;
+  Float           dx = band_dx(izeta);
+  Float           A0 = a(ix, iy, itheta, izeta);
+  bool interior = ix > 0 && iy > 0 && ix < band_n(izeta) - 1 && iy < band_n(izeta) - 1;
+  if (!interior || m_levelset[band_node(ix, iy, izeta)] < 2 * dx) {
+    return A0;
+  }
+  Vec2  dir        = WaveDirection(itheta);
+  int   itp        = (itheta + stride) % s.n_theta;
+  int   itm        = (itheta + s.n_theta - stride) % s.n_theta;
+  Float c          = GroupSpeed(ix, iy, izeta);
+  Float gamma      = std::min((Float)2.0 * (Float)0.025 * c * dt / dx, (Float)0.2) / (Float)(stride * stride);
+  Float dispersion = std::min((Float)0.025 * c * dt / dx, (Float)0.2);
+  Float delta      = (Float)1e-5 * dt;
+  Float angular    = a(ix, iy, itp, izeta) - 2 * A0 + a(ix, iy, itm, izeta);
+  Float spatial    = dir.x * dir.x * (a(ix + 1, iy, itheta, izeta) - 2 * A0 + a(ix - 1, iy, itheta, izeta))
+                   + dir.y * dir.y * (a(ix, iy + 1, itheta, izeta) - 2 * A0 + a(ix, iy - 1, itheta, izeta));
+  return (1 - delta) * A0 + gamma * angular + dispersion * spatial;
+}
+
+template <Grid::Layout L, class S>
+void WaveGrid::diffusion_kernel(const Tile& t, int izeta, Float dt) {
+  GridAccessor<L, const Float, S> a   = m_amplitude.ConstView<L, S>();
+  GridAccessor<L, Float, S>       dst = m_amplitude.BackView<L, S>();
+  m_amplitude.ForEachCell<L>(t.x0, t.y0, t.x1, t.y1, izeta, izeta + 1, [&](int ix, int iy, int itheta, int izeta) {
+    if (itheta % t.stride == 0) {
+      dst(ix, iy, itheta, izeta) = diffused_amplitude(a, ix, iy, itheta, izeta, dt, t.stride);
+    }
+  });
+}
+
+template <Grid::Layout L, class S>
+void WaveGrid::diffusion_pass() {
+  run_tiles<L, S>(true, [&](const Tile& t, int izeta, Float dt, int) {
+    diffusion_kernel<L, S>(t, izeta, dt);
+  });
+}
+
+void WaveGrid::diffusion_step() {
+  dispatch(m_amplitude, [&](auto f) { this->diffusion_pass<decltype(f)::layout, typename decltype(f)::Storage>(); });
+}
+
+// Advects a tile plus a one node halo into worker-local scratch, then runs the
+// diffusion stencil from there, so the grid is streamed through once per
+// step instead of twice. The halo nodes are advected by both neighbouring
+// tiles, which keeps tiles independent and the result identical to
+// advection_step followed by diffusion_step.
+template <Grid::Layout L, class S>
+void WaveGrid::fused_kernel(const Tile& t, int izeta, Float dt, int worker) {
+  const Settings&                 s    = m_settings;
+  GridAccessor<L, const Float, S> src  = m_amplitude.ConstView<L, S>();
+  GridAccessor<L, Float, S>       dst  = m_amplitude.BackView<L, S>();
+  unsigned char*                  slow = m_slowLanes[worker].data();
+  Tile        b = band_tile(t, izeta);
+  Tile        h = halo(b, izeta);
+  ScratchView a = { m_scratch[worker].data(), h.x0, h.y0, h.x1 - h.x0, h.y1 - h.y0 };
+  Shift          shift;
+  wsw::AdvectRow row;
+  for (int itheta = 0; itheta < s.n_theta; itheta += t.stride) {
+    if (uniform_shift(h, tile_index(t), itheta, izeta, dt, shift)) {
+      shift_slice(src, a, h, itheta, izeta, shift, m_shiftRows[worker].data());
+      m_shiftedCells[worker] += (long long)(h.x1 - h.x0) * (h.y1 - h.y0);
+      continue;
+    }
+    const Stencil* stencils = slice_stencils(tile_index(t), itheta, izeta);
+    if (L == Grid::Linear && std::is_same<S, wsw::FloatStorage>::value && m_advectRow) {
+      GridAccessor<Grid::Linear, const Float> linear = m_amplitude.ConstView<Grid::Linear>();
+      advect_slice(linear, row, h.x0, h.x1, itheta, izeta, dt);
+      for (int iy = h.y0; iy < h.y1; iy++) {
+        advect_row(linear, row, iy, itheta, izeta, dt, &a(h.x0, iy, itheta, izeta), slow,
+                   stencils ? stencils + (size_t)(iy - h.y0) * (h.x1 - h.x0) : nullptr);
+      }
+      continue;
+    }
+    if (stencils) {
+      replay_slice(src, a, h, h, itheta, izeta, stencils, dt);
+      continue;
+    }
+    for (int iy = h.y0; iy < h.y1; iy++) {
+      for (int ix = h.x0; ix < h.x1; ix++) {
+        a(ix, iy, itheta, izeta) = advected_amplitude(src, ix, iy, itheta, izeta, dt);
+      }
+    }
+  }
+  for (int itheta = 0; itheta < s.n_theta; itheta += t.stride) {
+    for (int iy = b.y0; iy < b.y1; iy++) {
+      for (int ix = b.x0; ix < b.x1; ix++) {
+        dst(ix, iy, itheta, izeta) = diffused_amplitude(a, ix, iy, itheta, izeta, dt, t.stride);
+      }
+    }
+  }
+}
+
+template <Grid::Layout L, class S>
+void WaveGrid::fused_pass() {
+  run_tiles<L, S>(true, [&](const Tile& t, int izeta, Float dt, int worker) {
+    fused_kernel<L, S>(t, izeta, dt, worker);
+  });
+}
+
+void WaveGrid::fused_step() {
+  dispatch(m_amplitude, [&](auto f) { this->fused_pass<decltype(f)::layout, typename decltype(f)::Storage>(); });
+}
+
+// (re)tabulates the integration nodes of every band; returns how many changed
+int WaveGrid::set_spectrum() {
+  const Settings& s       = m_settings;
+  Float           dzeta   = (s.max_zeta - s.min_zeta) / s.n_zeta;
+  int             changed = 0;
+  for (int izeta = 0; izeta < s.n_zeta; izeta++) {
+    Float zeta_min = s.min_zeta + izeta * dzeta;
+    Float zeta_max = zeta_min + dzeta;
+    if (s.spectrumType == Settings::LinearBasis) {
+      changed += m_profileBuffers[izeta].SetSpectrum([](Float) { return (Float)1.0; }, zeta_min, zeta_max);
+    } else {
+      changed += m_profileBuffers[izeta].SetSpectrum(m_spectrum, zeta_min, zeta_max);
+    }
+  }
+  return changed;
+}
+
+// the shape is picked here once; evaluating any of them is the same table lookup
+Spectrum WaveGrid::MakeSpectrum(const Settings& s) {
+  switch (s.spectrumType) {
+  case Settings::Jonswap: return Spectrum(wsw::JonswapShape(), s.spectrum);
+  case Settings::TMA:     return Spectrum(wsw::TmaShape(), s.spectrum);
+  default:                return Spectrum(wsw::PiersonMoskowitzShape(), s.spectrum);
+  }
+}
+
+void WaveGrid::SetSpectrum(const Spectrum& spectrum) {
+  m_spectrum    = spectrum;
+  m_energyStale = true;
+  if (m_tables) {
+    m_tables = nullptr;
+    m_profileBuffers.resize(m_settings.n_zeta);
+  }
+  set_spectrum();
+  precompute_profile_buffer();
+}
+
+// Only the bands whose table is stale (new time or new spectrum) are
+// re-evaluated, split into row chunks over the pool. A suspended band's
+// table waits until it resumes, unless another grid reads it.
+void WaveGrid::precompute_profile_buffer() {
+  const int rows = 512;
+  m_staleBands.clear();
+  int chunks = 0;
+  for (int izeta = 0; izeta < m_settings.n_zeta; izeta++) {
+    if (m_profileBuffers[izeta].Stale(m_time) && (m_bandTimings[izeta].live || m_lendsTables)) {
+      m_staleBands.push_back(izeta);
+      chunks = std::max(chunks, (m_profileBuffers[izeta].Resolution() + rows - 1) / rows);
+    }
+  }
+  m_pool->ParallelFor((int)m_staleBands.size() * chunks, [&](int task, int) {
+    ProfileBuffer& buffer = m_profileBuffers[m_staleBands[task / chunks]];
+    int            begin  = (task % chunks) * rows;
+    buffer.Evaluate(m_time, std::min(begin, buffer.Resolution()), std::min(begin + rows, buffer.Resolution()));
+  });
+  for (int izeta : m_staleBands) {
+    m_profileBuffers[izeta].MarkUpdated(m_time);
+  }
+  m_timings.profile_bands += (int)m_staleBands.size();
+}
+
+template <Grid::Layout L, class S>
+Vec4 WaveGrid::water_surface(Vec2 pos, const std::vector<ProfileBuffer>& profiles) const {
+  const Settings&                 s      = m_settings;
+  GridAccessor<L, const Float, S> a      = m_amplitude.ConstView<L, S>();
+  Float                           dtheta = wsw::tau / s.n_theta;
+  Vec4                            result(0);
+  for (int izeta = 0; izeta < s.n_zeta; izeta++) {
+    if (!m_bandTimings[izeta].live) { continue; }
+    for (int itheta = 0; itheta < s.n_theta; itheta++) {
+      Float amp = interpolated_amplitude(a, pos - s.center, (Float)itheta, izeta);
+      if (amp == (Float)0.0) { continue; }
+      Vec2  dir = WaveDirection(itheta);
+      Float p   = glm::dot(dir, pos) + wsw::tau * std::sin((Float)1.618 * itheta); // decorrelate directions
+      std::array<float, 4> w = profiles[izeta](p);
+      result.x += dtheta * amp * dir.x * w[0];
+      result.y += dtheta * amp * dir.y * w[0];
+      result.z += dtheta * amp * w[1];
+    }
+  }
+  return result;
+}
+
+Vec4 WaveGrid::WaterSurface(Vec2 pos, const std::vector<ProfileBuffer>& profiles) const {
+  return dispatch(m_amplitude, [&](auto f) { return this->water_surface<decltype(f)::layout, typename decltype(f)::Storage>(pos, profiles); });
+}
+
+Float WaveGrid::AmplitudeAt(Vec2 pos, Float itheta, int izeta) const {
+  return dispatch(m_amplitude, [&](auto f) {
+    typedef decltype(f) F;
+    return interpolated_amplitude(m_amplitude.ConstView<F::layout, typename F::Storage>(), pos - m_settings.center, itheta, izeta);
+  });
+}
+
+// The fine grid has half the spacing on the same center, so the bilinear
+// sample at a node is the mean of the 2 x 2 fine nodes in its cell.
+template <Grid::Layout L, class S>
+void WaveGrid::restrict_kernel(const WaveGrid& fine, const Tile& t) {
+  GridAccessor<L, Float, S> dst = m_amplitude.View<L, S>();
+  m_amplitude.ForEachCell<L>(t.x0, t.y0, t.x1, t.y1, [&](int ix, int iy, int itheta, int izeta) {
+    dst(ix, iy, itheta, izeta) = fine.AmplitudeAt(NodePosition(ix, iy, izeta) + m_settings.center, (Float)itheta, izeta);
+  });
+  if (m_settings.sparse) {
+    int index = tile_index(t);
+    m_tileAmplitude[index] = tile_amplitude<L, S>(m_amplitude.ConstView<L, S>(), tile(index));
+    m_tileQuiet[index]     = 0;
+  }
+}
+
+void WaveGrid::RestrictFrom(const WaveGrid& fine, Float extent) {
+  const Settings& s  = m_settings;
+  Float           dx = m_enviroment._dx;
+  // nodes whose whole cell lies within extent of the fine center
+  Vec2 lo = fine.GetSettings().center - s.center - Vec2(extent - (Float)0.5 * dx);
+  Vec2 hi = fine.GetSettings().center - s.center + Vec2(extent - (Float)0.5 * dx);
+  int  x0 = std::max((int)std::ceil((lo.x + s.size) / dx - (Float)0.5), 0);
+  int  y0 = std::max((int)std::ceil((lo.y + s.size) / dx - (Float)0.5), 0);
+  int  x1 = std::min((int)std::floor((hi.x + s.size) / dx - (Float)0.5) + 1, s.n_x);
+  int  y1 = std::min((int)std::floor((hi.y + s.size) / dx - (Float)0.5) + 1, s.n_x);
+  if (x0 >= x1 || y0 >= y1) {
+    return;
+  }
+  int tx0 = x0 / s.tile_size, tx1 = (x1 - 1) / s.tile_size + 1;
+  int ty0 = y0 / s.tile_size, ty1 = (y1 - 1) / s.tile_size + 1;
+  m_pool->ParallelFor((tx1 - tx0) * (ty1 - ty0), [&](int task, int) {
+    Tile t = tile((ty0 + task / (tx1 - tx0)) * m_tilesX + tx0 + task % (tx1 - tx0));
+    t.x0 = std::max(t.x0, x0);
+    t.y0 = std::max(t.y0, y0);
+    t.x1 = std::min(t.x1, x1);
+    t.y1 = std::min(t.y1, y1);
+    dispatch(m_amplitude, [&](auto f) { this->restrict_kernel<decltype(f)::layout, typename decltype(f)::Storage>(fine, t); });
+  });
+  m_energyStale = true;
+}
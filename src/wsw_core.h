@@ -0,0 +1,1053 @@
+#ifndef WSW_CORE_H
+#define WSW_CORE_H
+
+// Headless core of the water surface wavelets solver (no GL/GLUT/ImGui).
+
+#include "glm/glm.hpp"
+#include <vector>
+#include <array>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <cstring>
+#include <type_traits>
+#include <new>
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+#if !(USE_DOUBLE)
+typedef float        Float;
+typedef glm::vec2    Vec2;
+typedef glm::vec4    Vec4;
+#else
+typedef double       Float;
+typedef glm::f64vec2 Vec2;
+typedef glm::f64vec4 Vec4;
+#endif
+
+namespace wsw {
+  const Float tau     = (Float)6.28318530717958647692;
+  const Float gravity = (Float)9.81;
+
+  // omega(k) for finite depth h
+  inline Float dispersion_relation(Float k, Float h) {
+    return std::sqrt(gravity * k * std::tanh(std::min(k * h, (Float)20.0)));
+  }
+  inline Float group_speed(Float k, Float h) {
+    Float kh = std::min(k * h, (Float)20.0);
+    Float n  = (kh < (Float)20.0) ? (Float)0.5 * ((Float)1.0 + 2 * kh / std::sinh(2 * kh)) : (Float)0.5;
+    return n * dispersion_relation(k, h) / k;
+  }
+  inline Float cubic_bump(Float x) {
+    x = std::abs(x);
+    return (x >= (Float)1.0) ? (Float)0.0 : x * x * (2 * x - 3) + 1;
+  }
+  inline std::array<float, 4> gerstner_wave(Float phase, Float knum) {
+    Float s = std::sin(phase);
+    Float c = std::cos(phase);
+    return { (float)-s, (float)c, (float)(-knum * c), (float)(-knum * s) };
+  }
+
+  // instruction sets with an explicitly vectorized kernel, see WaveGrid::Settings::simd
+  enum SimdIsa { Scalar, SSE2, AVX2, AVX512, SimdAuto };
+  SimdIsa     best_simd_isa();    // widest one the running CPU supports
+  SimdIsa     default_simd_isa(); // what SimdAuto picks: the best up to AVX2
+  const char* simd_isa_name(SimdIsa isa);
+  struct AdvectRow;
+  typedef void (*AdvectRowFn)(const AdvectRow& row, Float* out, unsigned char* slow);
+
+  // posix_memalign / _aligned_malloc; nullptr when out of memory
+  void* aligned_alloc_bytes(size_t bytes, size_t align);
+  void  aligned_free(void* p);
+  const size_t HugePageSize = (size_t)2 << 20;
+  // whole 2 MiB pages, advised as transparent huge pages where the OS has
+  // them (madvise); freed with aligned_free
+  void* huge_alloc_bytes(size_t bytes);
+
+  // Amplitude storage policies of Grid: the element kept in memory and its
+  // conversion from and to Float, which the kernels do in registers.
+  struct FloatStorage {
+    typedef Float Stored;
+    static Float Load(Float v)  { return v; }
+    static Float Store(Float v) { return v; }
+  };
+  // IEEE binary16, round to nearest even; F16C when the build targets it
+  struct HalfStorage {
+    typedef uint16_t Stored;
+    static Float Load(uint16_t h) {
+#if defined(__F16C__)
+      return (Float)_cvtsh_ss(h);
+#else
+      const uint32_t magic = (254 - 15) << 23, infnan = (127 + 16) << 23;
+      uint32_t o = (uint32_t)(h & 0x7fff) << 13;
+      float    f, scale, limit;
+      memcpy(&f, &o, 4);
+      memcpy(&scale, &magic, 4);
+      memcpy(&limit, &infnan, 4);
+      f *= scale; // rebias the exponent, normalizes subnormals
+      memcpy(&o, &f, 4);
+      if (f >= limit) {
+        o |= 255 << 23;
+      }
+      o |= (uint32_t)(h & 0x8000) << 16;
+      memcpy(&f, &o, 4);
+      return (Float)f;
+#endif
+    }
+    static uint16_t Store(Float v) {
+#if defined(__F16C__)
+      return (uint16_t)_cvtss_sh((float)v, 0);
+#else
+      float    f = (float)v;
+      uint32_t x;
+      memcpy(&x, &f, 4);
+      uint32_t sign = x & 0x80000000u;
+      x ^= sign;
+      uint16_t o;
+      if (x >= 0x47800000u) {        // overflow to inf, nan stays nan
+        o = (x > 0x7f800000u) ? 0x7e00 : 0x7c00;
+      } else if (x < 0x38800000u) {  // subnormal: let the float adder round
+        const uint32_t magic = ((127 - 15) + (23 - 10) + 1) << 23;
+        float a, m;
+        memcpy(&a, &x, 4);
+        memcpy(&m, &magic, 4);
+        a += m;
+        memcpy(&x, &a, 4);
+        o = (uint16_t)(x - magic);
+      } else {
+        uint32_t odd = (x >> 13) & 1;
+        x += ((uint32_t)(15 - 127) << 23) + 0xfff + odd;
+        o = (uint16_t)(x >> 13);
+      }
+      return (uint16_t)(o | (sign >> 16));
+#endif
+    }
+  };
+  // upper half of an IEEE binary32, round to nearest even
+  struct BFloat16Storage {
+    typedef uint16_t Stored;
+    static Float Load(uint16_t b) {
+      uint32_t x = (uint32_t)b << 16;
+      float    f;
+      memcpy(&f, &x, 4);
+      return (Float)f;
+    }
+    static uint16_t Store(Float v) {
+      float    f = (float)v;
+      uint32_t x;
+      memcpy(&x, &f, 4);
+      if ((x & 0x7fffffffu) > 0x7f800000u) {
+        return (uint16_t)((x >> 16) | 0x40);
+      }
+      return (uint16_t)((x + 0x7fff + ((x >> 16) & 1)) >> 16);
+    }
+  };
+
+  // reference to one narrow stored element, converting on read and write
+  template <class S, class E>
+  class StoredRef {
+  public:
+    explicit StoredRef(E* p) : m_p(p) {}
+    operator Float() const { return S::Load(*m_p); }
+    const StoredRef& operator=(Float v) const { *m_p = S::Store(v); return *this; }
+  private:
+    E* m_p;
+  };
+  // T is Float or const Float; full precision elements are plain references
+  template <class S, class T>
+  struct StorageTraits {
+    typedef typename std::conditional<std::is_const<T>::value, const typename S::Stored, typename S::Stored>::type Element;
+    typedef StoredRef<S, Element> Reference;
+    static Reference Ref(Element* p) { return Reference(p); }
+  };
+  template <class T>
+  struct StorageTraits<FloatStorage, T> {
+    typedef T  Element;
+    typedef T& Reference;
+    static Reference Ref(Element* p) { return *p; }
+  };
+
+  // std::allocator replacement handing out cache-line aligned blocks, so the
+  // grid rows the vector kernels stream start on a line. With `huge`, blocks
+  // of a huge page or more go on huge pages instead. Elements are
+  // default-initialized, so vector(n) leaves the pages untouched and the
+  // first thread to write a page places it (first touch).
+  template <class T, size_t Align = 64>
+  struct AlignedAllocator {
+    typedef T         value_type;
+    typedef std::true_type propagate_on_container_swap;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    template <class U> struct rebind { typedef AlignedAllocator<U, Align> other; };
+    explicit AlignedAllocator(bool huge_pages = false) : huge(huge_pages) {}
+    template <class U> AlignedAllocator(const AlignedAllocator<U, Align>& other) : huge(other.huge) {}
+    T* allocate(size_t n) {
+      size_t bytes = n * sizeof(T);
+      void*  p     = (huge && bytes >= HugePageSize) ? huge_alloc_bytes(bytes) : aligned_alloc_bytes(bytes, Align);
+      if (!p) {
+        throw std::bad_alloc();
+      }
+      return (T*)p;
+    }
+    void deallocate(T* p, size_t) { aligned_free(p); }
+    template <class U> void construct(U* p) { ::new ((void*)p) U; }
+    template <class U, class... Args> void construct(U* p, Args&&... args) { ::new ((void*)p) U(std::forward<Args>(args)...); }
+    template <class U> bool operator==(const AlignedAllocator<U, Align>& other) const { return huge == other.huge; }
+    template <class U> bool operator!=(const AlignedAllocator<U, Align>& other) const { return huge != other.huge; }
+    bool huge;
+  };
+  template <class T> using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+}
+
+// Spectrum shapes, as compile-time policies: Log2Density(zeta, p) is log2 of
+// the spectral density at zeta = log2(wavelength). They are only evaluated
+// when a Spectrum fills its table.
+namespace wsw {
+  struct SpectrumParams {
+    Float wind_speed = 10;            // m/s at 10 m
+    Float fetch      = (Float)100e3;  // m of open water upwind, JONSWAP and TMA
+    Float gamma      = (Float)3.3;    // peak enhancement, JONSWAP and TMA
+    Float depth      = 20;            // m, TMA
+  };
+  struct PiersonMoskowitzShape {
+    static Float Log2Density(Float zeta, const SpectrumParams& p) {
+      const Float log2_e = (Float)1.4426950408889634;
+      Float a = (Float)1.5 * zeta * (Float)0.13750352374993502;                              // log2(1.1^(1.5 zeta))
+      Float b = (Float)-1.8038897788076411 * std::exp2(2 * zeta) / std::pow(p.wind_speed, (Float)4.0) * log2_e; // log2(B)
+      return (Float)-2.845826418435142 + (Float)0.5 * (a + b);                               // log2(0.139098 sqrt(A B))
+    }
+  };
+  // Fetch-limited sea: the PM shape with its peak at the JONSWAP frequency
+  // 22 (g^2 / (U F))^(1/3) (never below the fully developed one, so a long
+  // fetch and gamma = 1 give PM back) and enhanced by gamma^r around it.
+  struct JonswapShape {
+    static Float Log2Density(Float zeta, const SpectrumParams& p) {
+      const Float log2_e = (Float)1.4426950408889634;
+      Float omega   = std::sqrt(gravity * tau / std::exp2(zeta)); // deep water
+      Float pm_peak = std::pow((Float)1.8038897788076411 * (Float)0.8 * gravity * gravity * tau * tau, (Float)0.25) / p.wind_speed;
+      Float peak    = std::max((Float)22.0 * std::cbrt(gravity * gravity / (p.wind_speed * p.fetch)), pm_peak);
+      Float sigma   = (omega <= peak) ? (Float)0.07 : (Float)0.09;
+      Float r       = std::exp(-(omega - peak) * (omega - peak) / (2 * sigma * sigma * peak * peak));
+      Float a       = (Float)1.5 * zeta * (Float)0.13750352374993502;
+      Float b       = (Float)-1.25 * std::pow(peak / omega, (Float)4.0) * log2_e;
+      return (Float)-2.845826418435142 + (Float)0.5 * (a + b + r * std::log2(p.gamma));
+    }
+  };
+  // JONSWAP in finite depth: times Kitaigorodskii's depth factor of
+  // omega sqrt(depth / g), which damps the waves longer than the depth allows
+  struct TmaShape {
+    static Float Log2Density(Float zeta, const SpectrumParams& p) {
+      Float omega = std::sqrt(gravity * tau / std::exp2(zeta));
+      Float wh    = omega * std::sqrt(p.depth / gravity);
+      Float phi   = (wh <= (Float)1.0) ? (Float)0.5 * wh * wh : (wh <= (Float)2.0) ? 1 - (Float)0.5 * (2 - wh) * (2 - wh) : (Float)1.0;
+      return JonswapShape::Log2Density(zeta, p) + (Float)0.5 * std::log2(std::max(phi, (Float)1e-30));
+    }
+  };
+
+  // 2^x by the Taylor polynomial of 2^f for f in [-1/2, 1/2] and an exponent
+  // shift. Only integer selects, so loops over it vectorize; x is clamped
+  // to the normal range. Relative error below 3e-7 (float) and 2e-16 (double).
+  inline float fast_exp2(float x) {
+    float   t = x + 12582912.0f; // 1.5 2^23: the nearest integer lands in the low bits
+    int32_t bits;
+    memcpy(&bits, &t, 4);
+    int32_t i = bits - 0x4b400000;
+    int32_t c = std::min(std::max(i, -126), 126);
+    float   f = (x - (t - 12582912.0f)) * 0.69314718f;
+    int32_t fb;
+    memcpy(&fb, &f, 4);
+    fb &= -(int32_t)(i == c); // out of range: exactly 2^c
+    memcpy(&f, &fb, 4);
+    float   p = 1.0f + f * (1.0f + f * (1.0f / 2 + f * (1.0f / 6 + f * (1.0f / 24 + f * (1.0f / 120 + f * (1.0f / 720))))));
+    int32_t e = (c + 127) << 23;
+    float   scale;
+    memcpy(&scale, &e, 4);
+    return p * scale;
+  }
+  inline double fast_exp2(double x) {
+    double  t = x + 6755399441055744.0; // 1.5 2^52
+    int64_t bits;
+    memcpy(&bits, &t, 8);
+    int64_t i = bits - 0x4338000000000000ll;
+    int64_t c = std::min(std::max(i, (int64_t)-1022), (int64_t)1022);
+    double  f = (x - (t - 6755399441055744.0)) * 0.6931471805599453;
+    int64_t fb;
+    memcpy(&fb, &f, 8);
+    fb &= -(int64_t)(i == c);
+    memcpy(&f, &fb, 8);
+    const double inverse_factorial[13] = { 1.0 / 479001600, 1.0 / 39916800, 1.0 / 3628800, 1.0 / 362880, 1.0 / 40320, 1.0 / 5040,
+                                           1.0 / 720, 1.0 / 120, 1.0 / 24, 1.0 / 6, 1.0 / 2, 1.0, 1.0 };
+    double p = inverse_factorial[0];
+    for (int k = 1; k < 13; k++) {
+      p = p * f + inverse_factorial[k];
+    }
+    int64_t e = (c + 1023) << 52;
+    double  scale;
+    memcpy(&scale, &e, 8);
+    return p * scale;
+  }
+}
+
+// A spectrum shape sampled once for its parameters: log2 of the density on a
+// dense zeta grid, read back by linear interpolation and fast_exp2. Evaluating
+// it is a table fetch and a polynomial instead of pow and exp, whatever the
+// shape. The table is immutable and shared between copies.
+class Spectrum {
+public:
+  static const int TableOctaves = 32;  // zeta in [-16, 16]
+  static const int TableSteps   = 128; // samples per unit of zeta
+  Spectrum(Float windSpeed) : Spectrum(wsw::PiersonMoskowitzShape(), params(windSpeed)) {}
+  template <class Shape>
+  Spectrum(Shape, const wsw::SpectrumParams& p) : m_params(p), m_log2Density(&Shape::Log2Density) {
+    std::shared_ptr<std::vector<Float>> table = std::make_shared<std::vector<Float>>(TableOctaves * TableSteps + 1);
+    for (int i = 0; i <= TableOctaves * TableSteps; i++) {
+      (*table)[i] = Shape::Log2Density((Float)i / TableSteps - TableOctaves / 2, p);
+    }
+    m_table = table;
+  }
+  // density at zeta from the table
+  Float operator()(Float zeta) const { return lookup(m_table->data(), zeta); }
+  // density[k] = (*this)(zeta[k]) for k < n; the loop vectorizes
+  void operator()(const Float* __restrict zeta, Float* __restrict density, int n) const {
+    const Float* __restrict table = m_table->data();
+    for (int k = 0; k < n; k++) {
+      density[k] = lookup(table, zeta[k]);
+    }
+  }
+  // the shape evaluated directly, for reference
+  Float Exact(Float zeta) const { return std::exp2(m_log2Density(zeta, m_params)); }
+  Float WindSpeed() const { return m_params.wind_speed; }
+  const wsw::SpectrumParams& Params() const { return m_params; }
+  const std::vector<Float>&  Table()  const { return *m_table; }
+private:
+  // beyond the table the end segments extrapolate the log density linearly
+  static Float lookup(const Float* table, Float zeta) {
+    Float u = (zeta + TableOctaves / 2) * TableSteps;
+    int   i = std::min(std::max((int)u, 0), TableOctaves * TableSteps - 1);
+    Float w = u - (Float)i;
+    return wsw::fast_exp2(((Float)1.0 - w) * table[i] + w * table[i + 1]);
+  }
+  static wsw::SpectrumParams params(Float windSpeed) {
+    wsw::SpectrumParams p;
+    p.wind_speed = windSpeed;
+    return p;
+  }
+  wsw::SpectrumParams                       m_params;
+  Float                                   (*m_log2Density)(Float, const wsw::SpectrumParams&);
+  std::shared_ptr<const std::vector<Float>> m_table; // log2 density per zeta sample
+};
+
+class ProfileBuffer{
+public:
+  static const int DefaultResolution  = 4096;
+  static const int DefaultPeriodicity = 2;
+  static const int DefaultNodes       = 100;
+  wsw::AlignedVector<std::array<float, 4>> data;
+  // Integrates the wave profile over [zeta_min, zeta_max] into a periodic table.
+  // `spectrum` is any callable Float(Float zeta).
+  template <class SpectrumFn>
+  void Precompute(const SpectrumFn& spectrum, Float time, Float zeta_min, Float zeta_max,
+                  int resolution = DefaultResolution, int periodicity = DefaultPeriodicity, int integration_nodes = DefaultNodes) {
+    SetSpectrum(spectrum, zeta_min, zeta_max, resolution, periodicity, integration_nodes);
+    Evaluate(time, 0, Resolution());
+    MarkUpdated(time);
+  }
+  // Tabulates the integration nodes of the band; the table only goes stale
+  // when they actually change. Returns whether they did.
+  template <class SpectrumFn>
+  bool SetSpectrum(const SpectrumFn& spectrum, Float zeta_min, Float zeta_max,
+                   int resolution = DefaultResolution, int periodicity = DefaultPeriodicity, int integration_nodes = DefaultNodes);
+  // fills rows [begin, end) of the table for `time`; disjoint ranges may run concurrently
+  void Evaluate(Float time, int begin, int end);
+  bool Stale(Float time) const { return m_dirty || time != m_time; }
+  // time-averaged mean square of the height column, up to a factor common
+  // to every band: the summed squared node weights, fixed by SetSpectrum
+  double MeanSquare() const;
+  void MarkUpdated(Float time) { m_time = time; m_dirty = false; }
+  // periodic, linearly interpolated lookup
+  std::array<float, 4> operator()(Float p) const;
+  Float Period() const { return m_period; }
+  int   Resolution() const { return (int)data.size(); }
+  Float Time() const { return m_time; }
+  // integration nodes, exposed for the on-disk cache
+  const std::vector<double>& Wavenumbers() const { return m_wavenumber; }
+  const std::vector<double>& Omegas()      const { return m_omega; }
+  const std::vector<double>& Weights()     const { return m_weight; }
+  // reinstates a table evaluated at `time` without recomputing anything
+  void Restore(Float period, Float time, int nodes, const double* wavenumber, const double* omega, const double* weight,
+               int resolution, const std::array<float, 4>* table) {
+    m_period = period;
+    m_wavenumber.assign(wavenumber, wavenumber + nodes);
+    m_omega.assign(omega, omega + nodes);
+    m_weight.assign(weight, weight + nodes);
+    data.assign(table, table + resolution);
+    MarkUpdated(time);
+  }
+private:
+  Float               m_period = 0;
+  Float               m_time   = 0;
+  bool                m_dirty  = true;
+  std::vector<double> m_wavenumber; // per integration node
+  std::vector<double> m_omega;
+  std::vector<double> m_weight;
+};
+
+// where one zeta band of a Grid lives in a buffer: its nodes are 2^shift
+// times as far apart as those of a band of shift 0
+struct GridBand {
+  size_t offset; // of its first element, within a buffer (in a view: within the allocation)
+  int    n_x, n_y;
+  int    tiles_x;
+  int    shift;
+};
+
+// Layout- and storage-resolved view of a Grid; kernels are templated on it so
+// the switch happens once per pass instead of once per access.
+template <int L, class T, class S = wsw::FloatStorage>
+class GridAccessor {
+public:
+  typedef typename wsw::StorageTraits<S, T>::Element   Element;
+  typedef typename wsw::StorageTraits<S, T>::Reference Reference;
+  GridAccessor(Element* data, const std::array<int, 4>& dims, const GridBand* bands) : m_data(data), m_dims(dims), m_bands(bands) {}
+  Reference operator()(int ix, int iy, int itheta, int izeta) const { return wsw::StorageTraits<S, T>::Ref(m_data + Index(ix, iy, itheta, izeta)); }
+  size_t Index(int ix, int iy, int itheta, int izeta) const;
+  int    Dimension(int dim) const { return m_dims[dim]; }
+private:
+  Element*           m_data;
+  std::array<int, 4> m_dims;
+  const GridBand*    m_bands;
+};
+
+class Grid {
+public:
+  enum { X, Y, Theta, Zeta };
+  enum Layout {
+    Linear, // x fastest, then y, theta, zeta
+    Tiled   // TileSize x TileSize spatial tiles, theta contiguous per cell, zeta outermost
+  };
+  enum Storage {
+    Full,    // Float
+    Half,    // IEEE binary16, see wsw::HalfStorage
+    BFloat16 // see wsw::BFloat16Storage
+  };
+  static const int TileShift = 3;
+  static const int TileSize  = 1 << TileShift;
+  Grid() : dimensions(), m_layout(Linear), m_storage(Full), m_cells(0), m_stride(0), m_buffers(0) {}
+  // `buffers` same-shaped buffers share one allocation; the front one is the
+  // grid's contents and the next one (the back) a target to step into, see
+  // Flip. Each band has its own front, so bands can flip independently.
+  // Band izeta is 2^shifts[izeta] times coarser than n_x x n_y (empty:
+  // every band at n_x x n_y).
+  void Resize(int n_x, int n_y, int n_theta, int n_zeta, Layout layout = Linear, Float value = 0, Storage storage = Full, int buffers = 1,
+              const std::vector<int>& shifts = std::vector<int>()) {
+    Allocate(n_x, n_y, n_theta, n_zeta, layout, storage, buffers, false, shifts);
+    std::fill(data.begin(), data.end(), value);
+    std::fill(m_narrow.begin(), m_narrow.end(), (storage == Half) ? wsw::HalfStorage::Store(value) : wsw::BFloat16Storage::Store(value));
+  }
+  // Same, but leaves the new buffers unwritten, so the threads that first
+  // write each part of them decide where its pages live. With huge_pages the
+  // buffers go on 2 MiB huge pages.
+  void Allocate(int n_x, int n_y, int n_theta, int n_zeta, Layout layout = Linear, Storage storage = Full, int buffers = 1, bool huge_pages = false,
+                const std::vector<int>& shifts = std::vector<int>()) {
+    dimensions = { n_x, n_y, n_theta, n_zeta };
+    m_layout   = layout;
+    m_storage  = storage;
+    m_buffers  = std::max(buffers, 1);
+    m_cells    = 0;
+    m_bands.resize(n_zeta);
+    for (int izeta = 0; izeta < n_zeta; izeta++) {
+      GridBand& b = m_bands[izeta];
+      b.shift   = shifts.empty() ? 0 : shifts[izeta];
+      b.n_x     = std::max((n_x + (1 << b.shift) - 1) >> b.shift, 1);
+      b.n_y     = std::max((n_y + (1 << b.shift) - 1) >> b.shift, 1);
+      b.tiles_x = (b.n_x + TileSize - 1) >> TileShift;
+      b.offset  = m_cells;
+      m_cells  += ((layout == Tiled) ? (size_t)b.tiles_x * ((b.n_y + TileSize - 1) >> TileShift) * TileSize * TileSize : (size_t)b.n_x * b.n_y) * n_theta;
+    }
+    m_stride   = (m_cells + 31) & ~(size_t)31; // every buffer starts on a cache line
+    data     = wsw::AlignedVector<Float>((storage == Full) ? m_stride * m_buffers : 0, wsw::AlignedAllocator<Float>(huge_pages));
+    m_narrow = wsw::AlignedVector<uint16_t>((storage == Full) ? 0 : m_stride * m_buffers, wsw::AlignedAllocator<uint16_t>(huge_pages));
+    m_bandFront.assign(n_zeta, 0);
+    m_flips.assign(n_zeta, 1);
+    m_frontBands = m_backBands = m_nextBands = m_bands;
+    for (int izeta = 0; izeta < n_zeta; izeta++) {
+      update_views(izeta);
+    }
+  }
+  Float operator()(int ix, int iy, int itheta, int izeta) const {
+    size_t i = index(ix, iy, itheta, izeta);
+    return (m_storage == Full) ? data[i] : (m_storage == Half) ? wsw::HalfStorage::Load(m_narrow[i]) : wsw::BFloat16Storage::Load(m_narrow[i]);
+  }
+  void Set(int ix, int iy, int itheta, int izeta, Float value) {
+    size_t i = index(ix, iy, itheta, izeta);
+    if (m_storage == Full) {
+      data[i] = value;
+    } else {
+      m_narrow[i] = (m_storage == Half) ? wsw::HalfStorage::Store(value) : wsw::BFloat16Storage::Store(value);
+    }
+  }
+  // views of the front buffer; S must match GetStorage()
+  template <Layout L, class S = wsw::FloatStorage> GridAccessor<L, Float, S>       View()       { return GridAccessor<L, Float, S>(elements((typename S::Stored*)nullptr), dimensions, m_frontBands.data()); }
+  template <Layout L, class S = wsw::FloatStorage> GridAccessor<L, const Float, S> View() const { return ConstView<L, S>(); }
+  template <Layout L, class S = wsw::FloatStorage> GridAccessor<L, const Float, S> ConstView() const {
+    return GridAccessor<L, const Float, S>(elements((const typename S::Stored*)nullptr), dimensions, m_frontBands.data());
+  }
+  // views of the back buffer, the one Flip brings to the front
+  template <Layout L, class S = wsw::FloatStorage> GridAccessor<L, Float, S> BackView() {
+    return GridAccessor<L, Float, S>(elements((typename S::Stored*)nullptr), dimensions, m_backBands.data());
+  }
+  template <Layout L, class S = wsw::FloatStorage> GridAccessor<L, const Float, S> ConstBackView() const {
+    return GridAccessor<L, const Float, S>(elements((const typename S::Stored*)nullptr), dimensions, m_backBands.data());
+  }
+  // view of what will be the front buffer after Flip: the back of the bands
+  // that flip, the front of the others
+  template <Layout L, class S = wsw::FloatStorage> GridAccessor<L, const Float, S> ConstNextView() const {
+    return GridAccessor<L, const Float, S>(elements((const typename S::Stored*)nullptr), dimensions, m_nextBands.data());
+  }
+  // makes the back buffer the front one of every band marked by SetFlip (by
+  // default all), in O(n_zeta): buffers rotate, nothing is copied
+  void    Flip() {
+    for (int izeta = 0; izeta < dimensions[Zeta]; izeta++) {
+      if (m_flips[izeta]) {
+        m_bandFront[izeta] = (m_bandFront[izeta] + 1) % m_buffers;
+        update_views(izeta);
+      }
+    }
+  }
+  // whether Flip rotates band izeta's buffers
+  void    SetFlip(int izeta, bool flips) { m_flips[izeta] = flips; update_views(izeta); }
+  bool    Flips(int izeta) const { return m_flips[izeta] != 0; }
+  // calls fn(ix, iy, itheta, izeta) for every cell in storage order, with
+  // (ix, iy) in the nodes of band izeta
+  template <Layout L, class Fn> void ForEachCell(Fn fn) const { ForEachCell<L>(0, 0, dimensions[X], dimensions[Y], fn); }
+  // same, restricted to the bands in [z0, z1) and to the nodes whose centers
+  // lie in the cells of [x0, x1) x [y0, y1), counted in nodes of shift 0
+  template <Layout L, class Fn> void ForEachCell(int x0, int y0, int x1, int y1, Fn fn) const { ForEachCell<L>(x0, y0, x1, y1, 0, dimensions[Zeta], fn); }
+  template <Layout L, class Fn> void ForEachCell(int x0, int y0, int x1, int y1, int z0, int z1, Fn fn) const;
+  // of shift 0; band izeta has GetBand(izeta).n_x x n_y nodes
+  int    Dimension(int dim) const { return dimensions[dim]; }
+  const GridBand& GetBand(int izeta) const { return m_bands[izeta]; }
+  // first node of a band of `shift` whose center lies at or after the cell of node x of shift 0
+  static int BandNode(int x, int shift) { return shift ? (x + (1 << (shift - 1)) - 1) >> shift : x; }
+  Layout  GetLayout()  const { return m_layout; }
+  Storage GetStorage() const { return m_storage; }
+  int     Buffers()    const { return m_buffers; }
+  bool    HugePages()  const { return data.get_allocator().huge || m_narrow.get_allocator().huge; }
+  // cells and bytes of one buffer
+  size_t  Size()  const { return m_cells; }
+  size_t  Bytes() const { return m_cells * ((m_storage == Full) ? sizeof(Float) : sizeof(uint16_t)); }
+  void    Swap(Grid& other) {
+    data.swap(other.data);
+    m_narrow.swap(other.m_narrow);
+    std::swap(dimensions, other.dimensions);
+    std::swap(m_layout, other.m_layout);
+    std::swap(m_storage, other.m_storage);
+    m_bands.swap(other.m_bands);
+    m_frontBands.swap(other.m_frontBands);
+    m_backBands.swap(other.m_backBands);
+    m_nextBands.swap(other.m_nextBands);
+    m_bandFront.swap(other.m_bandFront);
+    m_flips.swap(other.m_flips);
+    std::swap(m_cells, other.m_cells);
+    std::swap(m_stride, other.m_stride);
+    std::swap(m_buffers, other.m_buffers);
+  }
+private:
+  size_t index(int ix, int iy, int itheta, int izeta) const {
+    return (m_layout == Tiled) ? ConstView<Tiled>().Index(ix, iy, itheta, izeta) : ConstView<Linear>().Index(ix, iy, itheta, izeta);
+  }
+  // the band tables of the views, offsets counted from the start of the allocation
+  void update_views(int izeta) {
+    int front = m_bandFront[izeta];
+    int back  = (front + 1) % m_buffers;
+    m_frontBands[izeta].offset = m_bands[izeta].offset + m_stride * front;
+    m_backBands[izeta].offset  = m_bands[izeta].offset + m_stride * back;
+    m_nextBands[izeta].offset  = m_bands[izeta].offset + m_stride * (m_flips[izeta] ? back : front);
+  }
+  Float*          elements(Float*)                { return data.data(); }
+  const Float*    elements(const Float*)    const { return data.data(); }
+  uint16_t*       elements(uint16_t*)             { return m_narrow.data(); }
+  const uint16_t* elements(const uint16_t*) const { return m_narrow.data(); }
+  wsw::AlignedVector<Float>    data;
+  wsw::AlignedVector<uint16_t> m_narrow; // Half and BFloat16 elements
+  std::array<int, 4>         dimensions;
+  Layout                     m_layout;
+  Storage                    m_storage;
+  std::vector<GridBand>      m_bands;
+  std::vector<GridBand>      m_frontBands; // m_bands in the front buffer of each band
+  std::vector<GridBand>      m_backBands;
+  std::vector<GridBand>      m_nextBands;  // in the front buffer after Flip
+  std::vector<int>           m_bandFront;  // per band, index of its front buffer
+  std::vector<unsigned char> m_flips;      // per band, whether Flip rotates it
+  size_t                     m_cells;   // per buffer
+  size_t                     m_stride;  // elements between buffers
+  int                        m_buffers;
+};
+
+template <int L, class T, class S>
+inline size_t GridAccessor<L, T, S>::Index(int ix, int iy, int itheta, int izeta) const {
+  const GridBand& b = m_bands[izeta];
+  if (L == Grid::Tiled) {
+    const int mask = Grid::TileSize - 1;
+    size_t tile  = (size_t)(iy >> Grid::TileShift) * b.tiles_x + (ix >> Grid::TileShift);
+    size_t local = (size_t)(((iy & mask) << Grid::TileShift) | (ix & mask));
+    return b.offset + ((tile << (2 * Grid::TileShift)) + local) * m_dims[Grid::Theta] + itheta;
+  }
+  return b.offset + (size_t)ix + (size_t)b.n_x * ((size_t)iy + (size_t)b.n_y * (size_t)itheta);
+}
+
+template <Grid::Layout L, class Fn>
+void Grid::ForEachCell(int bx0, int by0, int bx1, int by1, int z0, int z1, Fn fn) const {
+  const int nt = dimensions[Theta];
+  if (L == Tiled) {
+    for (int izeta = z0; izeta < z1; izeta++) {
+      const GridBand& b = m_bands[izeta];
+      int x0 = std::min(BandNode(bx0, b.shift), b.n_x), x1 = std::min(BandNode(bx1, b.shift), b.n_x);
+      int y0 = std::min(BandNode(by0, b.shift), b.n_y), y1 = std::min(BandNode(by1, b.shift), b.n_y);
+      for (int ty = y0 >> TileShift; ty < ((y1 + TileSize - 1) >> TileShift); ty++) {
+        for (int tx = x0 >> TileShift; tx < ((x1 + TileSize - 1) >> TileShift); tx++) {
+          int ya = std::max(ty * TileSize, y0), yb = std::min((ty + 1) * TileSize, y1);
+          int xa = std::max(tx * TileSize, x0), xb = std::min((tx + 1) * TileSize, x1);
+          for (int iy = ya; iy < yb; iy++) {
+            for (int ix = xa; ix < xb; ix++) {
+              for (int itheta = 0; itheta < nt; itheta++) {
+                fn(ix, iy, itheta, izeta);
+              }
+            }
+          }
+        }
+      }
+    }
+    return;
+  }
+  for (int izeta = z0; izeta < z1; izeta++) {
+    const GridBand& b = m_bands[izeta];
+    int x0 = std::min(BandNode(bx0, b.shift), b.n_x), x1 = std::min(BandNode(bx1, b.shift), b.n_x);
+    int y0 = std::min(BandNode(by0, b.shift), b.n_y), y1 = std::min(BandNode(by1, b.shift), b.n_y);
+    for (int itheta = 0; itheta < nt; itheta++) {
+      for (int iy = y0; iy < y1; iy++) {
+        for (int ix = x0; ix < x1; ix++) {
+          fn(ix, iy, itheta, izeta);
+        }
+      }
+    }
+  }
+}
+
+// Test scene terrain: a round island with a sloped beach at the world origin,
+// sized for a domain of half-extent scene_size (0: size). Positions are
+// relative to the domain center `center`.
+class Environment {
+public:
+  float _dx;
+  Environment(Float size, int n, Vec2 center = Vec2(0), Float scene_size = 0)
+    : _dx((2 * size) / n), m_size(size), m_islandCenter(-center), m_islandRadius(((scene_size > (Float)0.0) ? scene_size : size) * (Float)0.2) {
+
+  }
+  bool  InDomain(Vec2 pos) const { return std::abs(pos.x) <= m_size && std::abs(pos.y) <= m_size; }
+  // signed distance to the shore line, negative on land
+  Float Levelset(Vec2 pos) const { return glm::length(pos - m_islandCenter) - m_islandRadius; }
+  Vec2  LevelsetGradient(Vec2 pos) const {
+    Vec2  d = pos - m_islandCenter;
+    Float l = glm::length(d);
+    return (l > (Float)0.0) ? d / l : Vec2(1, 0);
+  }
+  Float Depth(Vec2 pos) const { return glm::clamp((Float)0.5 * Levelset(pos), (Float)0.0, (Float)30.0); }
+  Float Size() const { return m_size; }
+private:
+  Float m_size;
+  Vec2  m_islandCenter;
+  Float m_islandRadius;
+};
+
+class ThreadPool;
+
+class WaveGrid {
+private:
+  void advection_step();
+  void diffusion_step();
+  void fused_step();
+  template <Grid::Layout L, class S> void advection_pass();
+  template <Grid::Layout L, class S> void diffusion_pass();
+  template <Grid::Layout L, class S> void fused_pass();
+  void precompute_profile_buffer();
+  int  set_spectrum();
+  int   schedule_bands(Float dt);
+  Float band_pass(int pass, int passes);
+  void schedule_tiles(Float dt, int passes);
+  void schedule_active_tiles(Float dt, int passes);
+  void measure_band_energy();
+public:
+  struct Settings {
+    Float size    = 50;
+    int   n_x     = 100;
+    int   n_theta = 8;
+    int   n_zeta  = 1;
+    Float min_zeta     = std::log2((Float)0.03);
+    Float max_zeta     = std::log2((Float)10.0);
+    Float initial_time = 100;
+    Grid::Layout layout = Grid::Linear;
+    // amplitudes in 16 bits halve the memory and traffic of the grids; the
+    // kernels still compute in Float. Only Full uses the vectorized advection
+    Grid::Storage storage = Grid::Full;
+    // vectorized advection of the Linear layout, clamped to what the CPU
+    // supports; SimdAuto stops at AVX2, AVX-512 has to be asked for
+    wsw::SimdIsa simd   = wsw::SimdAuto;
+    // the passes run over tile_size x tile_size node tiles on a work-stealing
+    // pool of `threads` threads (0: all hardware threads); the result does
+    // not depend on either
+    int   threads   = 0;
+    int   tile_size = 32;
+    // one streaming pass for advection + diffusion instead of two, for
+    // amplitude buffers of at least fused_min_bytes: a smaller one stays in
+    // cache between the two passes, which then beat the halo fused recomputes
+    bool   fused           = true;
+    size_t fused_min_bytes = (size_t)2 << 20;
+    // amplitude buffers on 2 MiB transparent huge pages (fewer TLB misses),
+    // each tile's pages first touched by the pool worker that steps it, so
+    // on a NUMA machine they live on that worker's node
+    bool  huge_pages = false;
+    // directory of the on-disk profile table cache (see wsw_cache.h), empty to disable
+    std::string cache_dir;
+    // skip the tiles whose summed amplitude is at most calm_threshold and that
+    // no active tile can reach within a step; they are drained to zero. With
+    // a threshold of 0 the result is the same as without
+    bool  sparse         = false;
+    Float calm_threshold = 0;
+    // open-water tiles whose angular spectrum is smooth step only every 2nd,
+    // 4th.. direction (up to max_theta_stride) and interpolate the others;
+    // theta_tolerance is the RMS interpolation error allowed, relative to the
+    // tile's peak amplitude; linear interpolation of the cos^2 ambient sea at
+    // n_theta 16 misses by about 0.07. Tiles within a tile of the shore keep
+    // every direction. The saving is paid for in accuracy: with strides up to
+    // 4 at n_theta 16 it steps 90% of the cells for a height error of 17% of
+    // the peak at n_x 128 (16 steps), and 53% of them, 28% faster, for 21% at
+    // n_x 400 (5 steps), so it is off by default and suits distant or
+    // preview grids rather than the surface the camera is close to
+    int   max_theta_stride = 1;
+    Float theta_tolerance  = (Float)0.1;
+    // slices of a tile in open deep water (one group speed over the tile and
+    // no shore or domain edge within a step) move by one constant offset, so
+    // they are advected by a separable two-tap shift instead of a backtrace
+    // per node; the result is the same bit for bit. Only band tiles of at
+    // least MinShiftSide nodes a side are shifted, and a grid with none that
+    // qualifies turns it off
+    bool  uniform_shift = true;
+    // the other backtraces depend only on the terrain and dt: they are
+    // resolved once per dt into stencils (source node and weights) that
+    // every step replays, 20 bytes per node of each slice not shifted (32
+    // with USE_DOUBLE), and give the traced result exactly
+    bool  cached_stencils = true;
+    // Multi-rate stepping: each zeta band takes the steps that move its
+    // fastest waves band_courant nodes (group speed x step / node spacing).
+    // A band that moves less per TimeStep is stepped every 2nd, 4th.. call,
+    // up to max_band_period, by the time since its last step; one that moves
+    // more is split into 2, 4.. substeps, up to max_band_substeps; that
+    // keeps a large dt stable but multiplies its work, so 1 (no substeps)
+    // is the default. Bands meet at every call that is a multiple of their
+    // periods. 0 steps every band once per call
+    Float band_courant      = 0;
+    int   max_band_period   = 8;
+    int   max_band_substeps = 1;
+    // Per-band spatial resolution: a band is stored on nodes 2, 4.. times
+    // as far apart as n_x (up to max_band_coarsening) while that spacing is
+    // at most band_spacing of its wavelength, so long waves take a fraction
+    // of the memory and work. The surface then differs from all bands at n_x
+    // by at most 1% of its peak at 0.5, 20% at 1 and 40% at 4 (the bounds
+    // wsw_tests and wsw_bench hold it to); with n_theta 16 and n_zeta 4 that
+    // is 0.2%, 7.7% and 2.5% at n_x 128 after 16 steps and 0.45%, 11% and
+    // 23% at n_x 400 after 5. The coarsening must divide n_x and tile_size.
+    // 0 keeps every band at n_x
+    Float band_spacing        = 0;
+    int   max_band_coarsening = 16;
+    // Band culling: every few steps each band's share of the surface energy
+    // (time-averaged mean square of its profile x of its amplitudes) and of the
+    // energy entering through the domain boundary is measured. A band below
+    // band_cull_fraction of both is suspended, frozen and neither stepped nor
+    // summed into the surface, until either share reaches twice that, e.g.
+    // once SetSpectrum changes the wind or the outer grid brings it in.
+    // 0 keeps every band live
+    Float band_cull_fraction  = 0;
+    // start at rest instead of from the ambient sea state, waves then only
+    // enter through the domain boundary
+    bool  calm_start     = false;
+    // world position of the domain center, and the half-extent the test
+    // scene is laid out for (0: size); the nested grids of a WaveClipmap
+    // share one scene
+    Vec2  center     = Vec2(0);
+    Float scene_size = 0;
+    enum SpectrumType {
+      LinearBasis,
+      PiersonMoskowitz,
+      Jonswap,
+      TMA
+    } spectrumType = PiersonMoskowitz;
+    // wind speed and, per spectrum type, fetch, peak enhancement and depth
+    wsw::SpectrumParams spectrum;
+  };
+  // per zeta band, see Settings::band_courant and band_cull_fraction
+  struct BandTimings {
+    double    seconds    = 0.0;  // in the tile kernels
+    long long steps      = 0;    // counting substeps
+    int       substeps   = 1;    // per stepped TimeStep call, as of the last call
+    int       period     = 1;    // TimeStep calls per step
+    bool      live       = true; // stepped and summed into the surface, see Settings::band_cull_fraction
+    long long live_calls = 0;    // TimeStep calls it was live in
+    double    share      = 0.0;  // of the surface energy, as of the last measurement
+    double    inflow     = 0.0;  // of the energy entering through the boundary, same
+  };
+  // wall-clock seconds spent per phase, accumulated over TimeStep calls
+  struct Timings {
+    double advection     = 0.0;
+    double diffusion     = 0.0;
+    double fused         = 0.0; // advection + diffusion when Settings::fused
+    double profile       = 0.0;
+    int    profile_bands = 0;   // profile tables re-evaluated
+    long long tiles      = 0;   // tiles stepped, see Settings::sparse
+    long long cells      = 0;   // (x, y, theta, zeta) cells stepped, see Settings::max_theta_stride
+    long long shifted    = 0;   // of those advected, the ones by the uniform shift (fused: with the halo)
+    double stencils      = 0.0; // building the cached stencils
+    int    stencil_builds = 0;  // times they were (re)built, once per new dt
+    double energy        = 0.0; // measuring the band energy, see Settings::band_cull_fraction
+    int    steps         = 0;
+  };
+  Spectrum    m_spectrum;
+  Environment m_enviroment;
+  WaveGrid(Settings& s);
+  // Same with `spectrum` (of s.spectrumType for s.spectrum; its table is
+  // shared, not copied) and, unless nullptr, the profile tables of `tables`:
+  // a grid of the same spectrum, bands and initial time that is stepped with
+  // the same time steps, marked with LendTables. This grid then neither
+  // builds nor updates its own. Unless nullptr, the passes run on `pool`
+  // (shared with other grids stepped one after the other, s.threads unused)
+  WaveGrid(Settings& s, const Spectrum& spectrum, const WaveGrid* tables, ThreadPool* pool = nullptr);
+  ~WaveGrid();
+  void TimeStep(Float dt);
+  // swaps in a new spectrum; only the bands whose tables change are recomputed.
+  // A grid reading another's tables builds its own from then on
+  void SetSpectrum(const Spectrum& spectrum);
+  // the Spectrum of s.spectrumType for s.spectrum (LinearBasis: PM)
+  static Spectrum MakeSpectrum(const Settings& s);
+  // (x displacement, y displacement, height, unused) of the surface at the world position pos
+  Vec4  WaterSurface(Vec2 pos) const { return WaterSurface(pos, ProfileBuffers()); }
+  // same, with the profile tables of another grid with the same bands
+  Vec4  WaterSurface(Vec2 pos, const std::vector<ProfileBuffer>& profiles) const;
+  const std::vector<ProfileBuffer>& ProfileBuffers() const { return m_tables ? m_tables->ProfileBuffers() : m_profileBuffers; }
+  // whether the profile tables are another grid's, see the constructor
+  bool  SharesTables() const { return m_tables != nullptr; }
+  // keeps every band's profile table current, suspended or not, for the
+  // grids constructed to read them; call before constructing those
+  void  LendTables() { m_lendsTables = true; }
+  // bilinear amplitude at the world position pos, clamped to the domain
+  Float AmplitudeAt(Vec2 pos, Float itheta, int izeta) const;
+  // Waves entering through the domain boundary are sampled from `outer`
+  // (same theta and zeta bands, covering this domain) instead of the ambient
+  // sea state; nullptr restores the ambient inflow.
+  void  SetInflow(const WaveGrid* outer) { m_outer = outer; m_energyStale = true; }
+  // Overwrites the nodes within `extent` of the center of `fine`, a grid of
+  // half the spacing on the same center and bands, with the mean of the fine
+  // nodes over each node's cell. This conserves the amplitude integral.
+  void  RestrictFrom(const WaveGrid& fine, Float extent);
+  Float Time() const { return m_time; }
+  const Settings& GetSettings() const { return m_settings; }
+  const Grid&     Amplitude()   const { return m_amplitude; }
+  const Timings&  GetTimings()  const { return m_timings; }
+  wsw::SimdIsa    ActiveSimd()  const { return m_simd; }
+  // wall-clock seconds the constructor spent on the profile tables, whether
+  // they came from the on-disk cache and, on a miss, whether they were saved
+  // to it
+  double          ProfileStartupTime() const { return m_profileStartup; }
+  bool            ProfileCacheHit()    const { return m_profileCacheHit; }
+  bool            ProfileCacheSaved()  const { return m_profileCacheSaved; }
+  const std::vector<BandTimings>& GetBandTimings() const { return m_bandTimings; }
+  void            ResetTimings() {
+    m_timings = Timings();
+    for (BandTimings& b : m_bandTimings) {
+      b.seconds    = 0.0;
+      b.steps      = 0;
+      b.live_calls = 0;
+    }
+  }
+  // bands live in the last TimeStep, see Settings::band_cull_fraction
+  int             LiveBands() const {
+    int n = 0;
+    for (const BandTimings& b : m_bandTimings) {
+      n += b.live;
+    }
+    return n;
+  }
+  // tiles stepped by the last TimeStep, out of TileCount()
+  int             ActiveTiles() const { return (int)m_tileTasks.size(); }
+  int             TileCount()   const { return tile_count(); }
+  // memory of the cached stencils, see Settings::cached_stencils
+  size_t          StencilBytes() const { return m_stencils.capacity() * sizeof(Stencil) + m_stencilSlices.capacity() * sizeof(size_t); }
+  // directions stepped per tile: every ThetaStride(t)-th
+  int             ThetaStride(int t) const { return m_tileStride[t]; }
+
+  // of node (ix, iy) of n_x, or of band izeta, see Settings::band_spacing
+  Vec2  NodePosition(int ix, int iy) const;
+  Vec2  NodePosition(int ix, int iy, int izeta) const;
+  Float Theta(int itheta) const;
+  Float Zeta(int izeta) const;
+  Vec2  WaveDirection(int itheta) const { return m_directions[itheta]; }
+  Float Wavenumber(int izeta) const;
+  // at node (ix, iy) of band izeta
+  Float GroupSpeed(int ix, int iy, int izeta) const { return m_groupSpeed[band_node(ix, iy, izeta)]; }
+private:
+  Float ambient_amplitude(int itheta, int izeta) const;
+  struct Bilinear { int ix0, iy0, it0, it1; Float wx, wy, wt; };
+  enum Departure { Land, Outside, Water, Reflected };
+  Bilinear  bilinear(Vec2 pos, Float itheta, int izeta) const;
+  Bilinear  traced_bilinear(int ix, int iy, int itheta, int izeta, Float dt) const;
+  Departure departure(int ix, int iy, int itheta, int izeta, Float dt, Vec2& src, Float& theta) const;
+  template <class A> Float interpolated_amplitude(const A& a, const Bilinear& b, int izeta) const;
+  template <class A> Float interpolated_amplitude(const A& a, Vec2 pos, Float itheta, int izeta) const {
+    return interpolated_amplitude(a, bilinear(pos, itheta, izeta), izeta);
+  }
+  template <class A> Float advected_amplitude(const A& a, int ix, int iy, int itheta, int izeta, Float dt) const;
+  struct Tile { int x0, y0, x1, y1, stride; };
+  struct Shift { int ox, oy; Float wx, wy; }; // source node offset and bilinear weights of a uniform shift
+  // a resolved backtrace: the amplitude is the bilinear blend of source
+  // corner (x, y) over directions theta and theta + 1. The weights are kept
+  // unquantized, as bilinear() computes them, so a replay matches the trace
+  // bit for bit; 16-bit weights would have saved 8 bytes per node but moved
+  // the surface by up to 1/65535 of a cell per step
+  struct Stencil {
+    static const uint16_t Land      = 0xffff; // x: the node is dry, amplitude 0
+    static const uint16_t Backtrace = 0xfffe; // x: fed by the boundary, traced every step
+    uint16_t x, y, theta;
+    Float    wx, wy, wt;
+  };
+  static const size_t NoStencils = ~(size_t)0;
+  static const int DetailInterval = 8;  // steps between measurements of the angular detail
+  static const int EnergyInterval = 8;  // steps between measurements of the band energy
+  static const int MinShiftSide   = 16; // nodes a side below which a uniform shift does not pay for its row filter
+  int  tile_count() const { return m_tilesX * m_tilesX; }
+  Tile tile(int t) const;
+  int  tile_index(const Tile& t) const { return (t.y0 / m_settings.tile_size) * m_tilesX + t.x0 / m_settings.tile_size; }
+  // nodes and spacing of band izeta, and tile t in its nodes
+  int    band_n(int izeta)     const { return m_amplitude.GetBand(izeta).n_x; }
+  int    band_shift(int izeta) const { return m_amplitude.GetBand(izeta).shift; }
+  Float  band_dx(int izeta)    const { return m_enviroment._dx * (Float)(1 << band_shift(izeta)); }
+  Tile   band_tile(const Tile& t, int izeta) const {
+    int b = band_shift(izeta);
+    return Tile{ t.x0 >> b, t.y0 >> b, t.x1 >> b, t.y1 >> b, t.stride };
+  }
+  size_t band_node(int ix, int iy, int izeta) const { return m_bandNodes[izeta] + (size_t)iy * band_n(izeta) + ix; }
+  // tile t of band izeta and one node around it, within the domain
+  Tile halo(const Tile& t, int izeta) const {
+    return Tile{ std::max(t.x0 - 1, 0), std::max(t.y0 - 1, 0), std::min(t.x1 + 1, band_n(izeta)), std::min(t.y1 + 1, band_n(izeta)), t.stride };
+  }
+  template <Grid::Layout L, class S, class Fn> void run_tiles(bool measure, const Fn& fn);
+  template <Grid::Layout L, class S> void clear_kernel(const Tile& t);
+  template <Grid::Layout L, class S> Float tile_amplitude(const GridAccessor<L, const Float, S>& a, const Tile& t) const;
+  template <Grid::Layout L, class S> Float theta_detail(const GridAccessor<L, const Float, S>& a, const Tile& t) const;
+  template <Grid::Layout L, class S> void  fill_thetas(const Tile& t, int izeta);
+  template <Grid::Layout L, class S> void  band_energy_kernel(const Tile& t, double* energy);
+  double inflow_energy(int izeta) const;
+  bool uniform_shift(const Tile& r, int t, int itheta, int izeta, Float dt, Shift& shift) const;
+  template <class A, class B> void shift_slice(const A& src, const B& dst, const Tile& r, int itheta, int izeta, const Shift& shift, Float* rows) const;
+  void build_stencils();
+  template <class A, class B> void replay_slice(const A& src, const B& dst, const Tile& r, const Tile& h, int itheta, int izeta,
+                                                const Stencil* stencils, Float dt) const;
+  const Stencil* slice_stencils(int t, int itheta, int izeta) const;
+  template <class A> Float replayed_amplitude(const A& src, const Stencil& c, int ix, int iy, int itheta, int izeta, Float dt) const;
+  template <Grid::Layout L, class S> void advection_kernel(const Tile& t, int izeta, Float dt, int worker);
+  void advect_slice(const GridAccessor<Grid::Linear, const Float>& src, wsw::AdvectRow& row,
+                    int x0, int x1, int itheta, int izeta, Float dt) const;
+  void advect_row(const GridAccessor<Grid::Linear, const Float>& src, wsw::AdvectRow& row,
+                  int iy, int itheta, int izeta, Float dt, Float* out, unsigned char* slow, const Stencil* stencils) const;
+  void advection_simd(const Tile& t, int izeta, Float dt, int worker);
+  template <class A> Float diffused_amplitude(const A& a, int ix, int iy, int itheta, int izeta, Float dt, int stride = 1) const;
+  template <Grid::Layout L, class S> void diffusion_kernel(const Tile& t, int izeta, Float dt);
+  template <Grid::Layout L, class S> void fused_kernel(const Tile& t, int izeta, Float dt, int worker);
+  template <Grid::Layout L, class S> Vec4 water_surface(Vec2 pos, const std::vector<ProfileBuffer>& profiles) const;
+  template <Grid::Layout L, class S> void restrict_kernel(const WaveGrid& fine, const Tile& t);
+
+  Settings                   m_settings;
+  Grid                       m_amplitude; // two buffers: the current step and the one being stepped into
+  std::vector<ProfileBuffer> m_profileBuffers;
+  std::vector<int>           m_staleBands; // scratch of precompute_profile_buffer
+  std::vector<Float>         m_groupSpeed; // per node of each band, depends on the local depth
+  std::vector<Vec2>          m_directions; // per theta
+  std::vector<Float>         m_ambient;    // per theta, the ambient sea state fed in at the boundary
+  std::vector<Float>         m_levelset;   // per node of each band
+  std::vector<size_t>        m_bandNodes;  // per zeta, offset of its nodes in m_groupSpeed and m_levelset
+  std::vector<std::vector<unsigned char>> m_slowLanes; // per worker and x, scratch of advect_row
+  std::vector<std::vector<Float>>         m_scratch;   // per worker, halo-padded tile of fused_kernel
+  std::vector<std::vector<Float>>         m_shiftRows; // per worker, the two filtered rows of shift_slice
+  std::vector<std::vector<unsigned char>> m_sliceDone; // per worker and (zeta, theta), advected slice-wise by advection_kernel
+  std::vector<long long>                  m_shiftedCells; // per worker, since the last TimeStep
+  wsw::SimdIsa               m_simd;
+  wsw::AdvectRowFn           m_advectRow;
+  std::unique_ptr<ThreadPool> m_ownPool; // nullptr: the pool is shared
+  ThreadPool*                m_pool;
+  const WaveGrid*            m_outer;
+  const WaveGrid*            m_tables; // owner of the profile tables, nullptr: this grid
+  bool                       m_lendsTables; // another grid reads this one's profile tables
+  int                        m_tilesX;
+  std::vector<int>           m_tileTasks;     // tiles stepped this step
+  std::vector<int>           m_tileClears;    // skipped tiles whose target may still hold amplitude
+  std::vector<Float>         m_tileAmplitude; // per tile, summed over the tile after the last step
+  std::vector<unsigned char> m_tileQuiet;     // per tile, passes skipped in a row (saturates at 2)
+  std::vector<int>           m_tileStride;    // per tile, theta stride of the next step
+  std::vector<Float>         m_tileDetail;    // per tile, relative error of doubling the stride
+  std::vector<unsigned char> m_tileShore;     // per tile, within a tile of the shore
+  std::vector<Float>         m_tileSpeed;     // per (tile, zeta), the group speed over the tile and its halo if uniform, else -1
+  std::vector<Float>         m_tileLevelset;  // per (tile, zeta), the least levelset over the tile and its halo
+  std::vector<Stencil>       m_stencils;      // per slice not shifted, over the tile and its halo
+  std::vector<size_t>        m_stencilSlices; // per (tile, zeta, theta), offset into m_stencils or NoStencils
+  std::vector<Float>         m_stencilDt;     // per zeta, the dt of its stencils, 0: none
+  std::vector<Float>         m_bandSpeed;     // per zeta, the fastest group speed
+  std::vector<Float>         m_bandDt;        // per zeta, dt of the pass being run, 0: not stepped nor flipped
+  std::vector<Float>         m_bandStep;      // per zeta, dt of each substep of this TimeStep
+  std::vector<int>           m_bandSubsteps;  // per zeta, substeps in this TimeStep, 0: not stepped
+  std::vector<Float>         m_bandLag;       // per zeta, time since the band was last stepped
+  std::vector<int>           m_bandCalls;     // per zeta, TimeStep calls since then
+  std::vector<double>        m_bandSeconds;   // per worker and zeta, since the last TimeStep
+  std::vector<BandTimings>   m_bandTimings;
+  std::vector<double>        m_tileEnergy;    // per tile and zeta, scratch of measure_band_energy
+  bool                       m_energyStale;   // forcing changed since the last measurement
+  Float                      m_maxGroupSpeed;
+  Float                      m_time;
+  Timings                    m_timings;
+  double                     m_profileStartup;
+  bool                       m_profileCacheHit;
+  bool                       m_profileCacheSaved;
+};
+
+template <class SpectrumFn>
+bool ProfileBuffer::SetSpectrum(const SpectrumFn& spectrum, Float zeta_min, Float zeta_max,
+                                int resolution, int periodicity, int integration_nodes) {
+  Float period = periodicity * std::pow((Float)2.0, zeta_max);
+  Float dzeta  = (zeta_max - zeta_min) / integration_nodes;
+  bool  same   = period == m_period && resolution == Resolution() && integration_nodes == (int)m_weight.size();
+  for (int n = 0; n < integration_nodes; n++) { // midpoint rule
+    Float zeta       = zeta_min + (n + (Float)0.5) * dzeta;
+    Float wavelength = std::pow((Float)2.0, zeta);
+    Float wavenumber = wsw::tau / wavelength;
+    Float omega      = wsw::dispersion_relation(wavenumber, (Float)1e3);
+    Float weight     = dzeta * wavelength * spectrum(zeta);
+    same = same && m_wavenumber[n] == wavenumber && m_omega[n] == omega && m_weight[n] == weight;
+    if (!same) {
+      m_wavenumber.resize(integration_nodes);
+      m_omega.resize(integration_nodes);
+      m_weight.resize(integration_nodes);
+      m_wavenumber[n] = wavenumber;
+      m_omega[n]      = omega;
+      m_weight[n]     = weight;
+    }
+  }
+  if (same) {
+    return false;
+  }
+  m_period = period;
+  data.assign(resolution, std::array<float, 4>{ 0.0f, 0.0f, 0.0f, 0.0f });
+  m_dirty = true;
+  return true;
+}
+
+#endif // WSW_CORE_H
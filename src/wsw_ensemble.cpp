@@ -0,0 +1,84 @@
+#include "wsw_ensemble.h"
+#include "wsw_thread_pool.h"
+#include "wsw_cache.h"
+#include <chrono>
+
+namespace {
+  typedef std::chrono::steady_clock clock;
+  double seconds_since(clock::time_point t0) {
+    return std::chrono::duration<double>(clock::now() - t0).count();
+  }
+  bool same_spectrum(const WaveGrid::Settings& a, const WaveGrid::Settings& b) {
+    return a.spectrumType == b.spectrumType && a.spectrum.wind_speed == b.spectrum.wind_speed && a.spectrum.fetch == b.spectrum.fetch &&
+           a.spectrum.gamma == b.spectrum.gamma && a.spectrum.depth == b.spectrum.depth;
+  }
+};
+
+// The Spectrum tables are built first, then the members owning profile
+// tables and then those reading them, each step in parallel over the pool.
+// The owners that lend their tables are marked in between, serially.
+WaveEnsemble::WaveEnsemble(const Settings& s) : m_pool(new ThreadPool(s.threads)), m_spectra(0), m_owners(0), m_stepTime(0.0), m_simTime(0.0) {
+  clock::time_point t0 = clock::now();
+  int n = (int)s.members.size();
+  std::vector<int> spectrum(n), owner(n);
+  std::vector<int> firsts; // first member of each distinct spectrum
+  for (int i = 0; i < n; i++) {
+    int j = 0;
+    while (j < (int)firsts.size() && !same_spectrum(s.members[firsts[j]], s.members[i])) {
+      j++;
+    }
+    if (j == (int)firsts.size()) {
+      firsts.push_back(i);
+    }
+    spectrum[i] = j;
+  }
+  std::vector<std::unique_ptr<Spectrum>> spectra(firsts.size());
+  m_pool->ParallelFor((int)firsts.size(), [&](int j, int) {
+    spectra[j].reset(new Spectrum(WaveGrid::MakeSpectrum(s.members[firsts[j]])));
+  });
+  std::vector<uint64_t> keys(n);
+  std::vector<int>      owners;
+  for (int i = 0; i < n; i++) {
+    keys[i]  = wsw::profile_cache_key(s.members[i], *spectra[spectrum[i]]);
+    owner[i] = i;
+    for (int o : owners) {
+      if (keys[o] == keys[i]) {
+        owner[i] = o;
+        break;
+      }
+    }
+    if (owner[i] == i) {
+      owners.push_back(i);
+    }
+  }
+  m_members.resize(n);
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 0; i < n && pass == 1; i++) {
+      if (owner[i] != i) {
+        m_members[owner[i]]->LendTables();
+      }
+    }
+    m_pool->ParallelFor(n, [&](int i, int) {
+      if ((owner[i] == i) == (pass == 0)) {
+        WaveGrid::Settings member = s.members[i];
+        member.threads = 1;
+        m_members[i].reset(new WaveGrid(member, *spectra[spectrum[i]], (owner[i] == i) ? nullptr : m_members[owner[i]].get()));
+      }
+    });
+  }
+  m_spectra  = (int)firsts.size();
+  m_owners   = (int)owners.size();
+  m_initTime = seconds_since(t0);
+}
+
+WaveEnsemble::~WaveEnsemble() {
+}
+
+void WaveEnsemble::TimeStep(Float dt) {
+  clock::time_point t0 = clock::now();
+  m_pool->ParallelFor(Members(), [&](int i, int) {
+    m_members[i]->TimeStep(dt);
+  });
+  m_stepTime += seconds_since(t0);
+  m_simTime  += (double)dt * Members();
+}
@@ -0,0 +1,49 @@
+#ifndef WSW_ENSEMBLE_H
+#define WSW_ENSEMBLE_H
+
+// Many independent WaveGrids of a parameter sweep (wind speeds, n_theta,
+// domain sizes..) stepped together in one process.
+//
+// Members of the same spectrum type and parameters share one Spectrum table,
+// and members whose profile tables would be identical (same spectrum, bands
+// and initial time, see wsw::profile_cache_key) read those of the first of
+// them instead of evaluating their own every step. The members are the
+// tasks of one thread pool and each steps single-threaded on the worker
+// that takes it, so a sweep of many small grids does not pay a pool
+// handoff per pass.
+
+#include "wsw_core.h"
+
+class WaveEnsemble {
+public:
+  struct Settings {
+    std::vector<WaveGrid::Settings> members; // their `threads` is ignored
+    int                             threads = 0; // of the shared pool, 0: all hardware threads
+  };
+  explicit WaveEnsemble(const Settings& s);
+  ~WaveEnsemble();
+  // steps every member by dt
+  void TimeStep(Float dt);
+  int  Members() const { return (int)m_members.size(); }
+  const WaveGrid& Member(int i) const { return *m_members[i]; }
+  // distinct Spectrum tables and profile table sets over all members
+  int  Spectra()     const { return m_spectra; }
+  int  TableOwners() const { return m_owners; }
+  // wall-clock seconds of construction and of the TimeStep calls, and the
+  // simulated seconds summed over members
+  double InitTime() const { return m_initTime; }
+  double StepTime() const { return m_stepTime; }
+  double SimTime()  const { return m_simTime; }
+  // simulated seconds per wall-clock second, summed over members
+  double Throughput() const { return m_stepTime > 0.0 ? m_simTime / m_stepTime : 0.0; }
+private:
+  std::vector<std::unique_ptr<WaveGrid>> m_members;
+  std::unique_ptr<ThreadPool>            m_pool;
+  int                                    m_spectra;
+  int                                    m_owners;
+  double                                 m_initTime;
+  double                                 m_stepTime;
+  double                                 m_simTime;
+};
+
+#endif // WSW_ENSEMBLE_H
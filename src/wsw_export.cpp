@@ -0,0 +1,191 @@
+#include "wsw_export.h"
+#include <cstdio>
+#include <cstring>
+
+namespace wsw {
+
+namespace {
+  const char     magic[8] = { 'W', 'S', 'W', 'H', 'G', 'H', 'T', '\0' };
+  const uint32_t version  = 1;
+
+  uint64_t align_up(uint64_t n, uint64_t a) { return (n + a - 1) / a * a; }
+  // byte offsets within a slot
+  uint64_t normals_offset(uint64_t samples) { return sizeof(HeightFieldFrame) + align_up(samples * sizeof(float), 64); }
+  uint64_t slot_size(uint64_t samples) { return align_up(normals_offset(samples) + samples * 2 * sizeof(int16_t), MappedFile::MapGranularity); }
+
+  int16_t snorm16(Float v) { return (int16_t)std::lround(std::min(std::max(v, (Float)-1.0), (Float)1.0) * 32767); }
+};
+
+HeightFieldWriter::HeightFieldWriter(const std::string& path, const Settings& s)
+  : m_settings(s), m_file(nullptr), m_header(), m_queued(0), m_head(0), m_frames(0), m_quit(false), m_failed(false), m_sampleTime(0.0), m_stallTime(0.0) {
+  m_settings.nx          = std::max(s.nx, 2);
+  m_settings.ny          = std::max(s.ny, 2);
+  m_settings.queue_depth = std::max(s.queue_depth, 1);
+  uint64_t samples = (uint64_t)m_settings.nx * m_settings.ny;
+  memcpy(m_header.magic, magic, sizeof(magic));
+  m_header.version      = version;
+  m_header.nx           = (uint32_t)m_settings.nx;
+  m_header.ny           = (uint32_t)m_settings.ny;
+  m_header.frame_stride = slot_size(samples);
+  m_header.data_offset  = MappedFile::MapGranularity;
+  m_header.dx           = 2 * (double)s.half_extent / m_settings.nx;
+  m_header.dy           = 2 * (double)s.half_extent / m_settings.ny;
+  m_header.x0           = (double)s.center.x - s.half_extent + 0.5 * m_header.dx; // cell centers
+  m_header.y0           = (double)s.center.y - s.half_extent + 0.5 * m_header.dy;
+  m_file = fopen(path.c_str(), "wb");
+  if (!m_file) {
+    return;
+  }
+  // the header slot, rewritten with the frame count on close
+  AlignedVector<unsigned char> head(m_header.data_offset, 0);
+  memcpy(head.data(), &m_header, sizeof(m_header));
+  if (fwrite(head.data(), head.size(), 1, m_file) != 1) {
+    fclose(m_file);
+    m_file = nullptr;
+    return;
+  }
+  for (int i = 0; i < m_settings.queue_depth; i++) {
+    m_slots.emplace_back(m_header.frame_stride, 0);
+  }
+  m_writer = std::thread(&HeightFieldWriter::writer_main, this);
+}
+
+HeightFieldWriter::~HeightFieldWriter() {
+  Close();
+}
+
+// waits for the oldest slot to be written if all of them are queued
+float* HeightFieldWriter::acquire(Float time) {
+  if (!m_file) {
+    return nullptr;
+  }
+  std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  {
+    std::unique_lock<std::mutex> guard(m_lock);
+    m_wake.wait(guard, [&] { return m_queued < (int)m_slots.size(); });
+  }
+  m_stallTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  HeightFieldFrame& frame = *(HeightFieldFrame*)m_slots[m_head].data();
+  frame.frame = m_frames;
+  frame.time  = (double)time;
+  frame.nx    = m_header.nx;
+  frame.ny    = m_header.ny;
+  return (float*)(m_slots[m_head].data() + sizeof(HeightFieldFrame));
+}
+
+void HeightFieldWriter::submit() {
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_queued++;
+  }
+  m_head = (m_head + 1) % (int)m_slots.size();
+  m_frames++;
+  m_wake.notify_all();
+}
+
+// central differences of the heights, one-sided at the border
+void HeightFieldWriter::encode_normals(unsigned char* slot) const {
+  const int    nx = m_settings.nx, ny = m_settings.ny;
+  const float* h  = (const float*)(slot + sizeof(HeightFieldFrame));
+  int16_t*     n  = (int16_t*)(slot + normals_offset((uint64_t)nx * ny));
+  for (int iy = 0; iy < ny; iy++) {
+    int y0 = std::max(iy - 1, 0), y1 = std::min(iy + 1, ny - 1);
+    for (int ix = 0; ix < nx; ix++) {
+      int   x0   = std::max(ix - 1, 0), x1 = std::min(ix + 1, nx - 1);
+      Float dhdx = (Float)(h[(size_t)iy * nx + x1] - h[(size_t)iy * nx + x0]) / (Float)((x1 - x0) * m_header.dx);
+      Float dhdy = (Float)(h[(size_t)y1 * nx + ix] - h[(size_t)y0 * nx + ix]) / (Float)((y1 - y0) * m_header.dy);
+      Float r    = 1 / std::sqrt(dhdx * dhdx + dhdy * dhdy + 1);
+      n[2 * ((size_t)iy * nx + ix)]     = snorm16(-dhdx * r);
+      n[2 * ((size_t)iy * nx + ix) + 1] = snorm16(-dhdy * r);
+    }
+  }
+}
+
+void HeightFieldWriter::writer_main() {
+  int tail = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> guard(m_lock);
+      m_wake.wait(guard, [&] { return m_quit || m_queued > 0; });
+      if (m_queued == 0) {
+        return; // quit with nothing left to write
+      }
+    }
+    unsigned char* slot = m_slots[tail].data();
+    encode_normals(slot);
+    HeightFieldIndex entry = { m_header.data_offset + m_index.size() * m_header.frame_stride, ((const HeightFieldFrame*)slot)->time };
+    if (!m_failed && fwrite(slot, m_header.frame_stride, 1, m_file) == 1) {
+      m_index.push_back(entry);
+    } else {
+      m_failed = true;
+    }
+    tail = (tail + 1) % (int)m_slots.size();
+    {
+      std::lock_guard<std::mutex> guard(m_lock);
+      m_queued--;
+    }
+    m_wake.notify_all();
+  }
+}
+
+bool HeightFieldWriter::Close() {
+  if (!m_file) {
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_quit = true;
+  }
+  m_wake.notify_all();
+  m_writer.join();
+  bool ok = !m_failed;
+  m_header.frames       = m_index.size();
+  m_header.index_offset = m_header.data_offset + m_index.size() * m_header.frame_stride;
+  ok = ok && fwrite(m_index.data(), sizeof(HeightFieldIndex), m_index.size(), m_file) == m_index.size();
+  ok = ok && fseek(m_file, 0, SEEK_SET) == 0 && fwrite(&m_header, sizeof(m_header), 1, m_file) == 1;
+  ok = (fclose(m_file) == 0) && ok;
+  m_file = nullptr;
+  return ok;
+}
+
+HeightFieldReader::HeightFieldReader(const std::string& path) : m_path(path), m_header(), m_ok(false) {
+  FILE* fp = fopen(path.c_str(), "rb");
+  if (!fp) {
+    return;
+  }
+  m_ok = fread(&m_header, sizeof(m_header), 1, fp) == 1 && memcmp(m_header.magic, magic, sizeof(magic)) == 0 && m_header.version == version &&
+         m_header.frame_stride == slot_size((uint64_t)m_header.nx * m_header.ny) && m_header.data_offset % MappedFile::MapGranularity == 0;
+  fclose(fp);
+}
+
+int HeightFieldReader::Frames() const {
+  if (!m_ok) {
+    return 0;
+  }
+  if (m_header.index_offset) {
+    return (int)m_header.frames;
+  }
+  FILE* fp = fopen(m_path.c_str(), "rb");
+  if (!fp) {
+    return 0;
+  }
+  fseek(fp, 0, SEEK_END);
+  long long size = ftell(fp);
+  fclose(fp);
+  return (size > (long long)m_header.data_offset) ? (int)(((uint64_t)size - m_header.data_offset) / m_header.frame_stride) : 0;
+}
+
+std::unique_ptr<MappedFile> HeightFieldReader::MapFrame(int k) const {
+  if (!m_ok || k < 0 || (m_header.index_offset && (uint64_t)k >= m_header.frames)) {
+    return std::unique_ptr<MappedFile>(new MappedFile(std::string()));
+  }
+  return std::unique_ptr<MappedFile>(new MappedFile(m_path, m_header.data_offset + (uint64_t)k * m_header.frame_stride, (size_t)m_header.frame_stride));
+}
+
+Vec2 HeightFieldReader::Normal(const MappedFile& f, size_t i) {
+  const HeightFieldFrame& frame = Frame(f);
+  const int16_t*          n     = (const int16_t*)(f.Data() + normals_offset((uint64_t)frame.nx * frame.ny));
+  return Vec2((Float)n[2 * i] / 32767, (Float)n[2 * i + 1] / 32767);
+}
+
+}
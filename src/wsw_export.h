@@ -0,0 +1,142 @@
+#ifndef WSW_EXPORT_H
+#define WSW_EXPORT_H
+
+// Streaming export of the simulated surface as per-frame height and normal
+// grids, for compositing outside the simulator.
+//
+// Every frame occupies a slot of the same size, aligned to the mapping
+// granularity, so frame k is one mmap at data_offset + k * frame_stride and
+// never needs frames 0..k-1. Closing the file appends the frame index and
+// patches the header; a file that was never closed (or is still being
+// written) holds as many frames as whole slots fit in it.
+//   header | magic "WSWHGHT", version, nx, ny, frame_stride, data_offset,
+//          | frames, index_offset, world position of sample (0, 0), spacing
+//   slot   | frame number, time, nx, ny | nx x ny height (float)
+//          | nx x ny normal (x, y) as snorm16, z = sqrt(1 - x^2 - y^2) | padding
+//   index  | frames x (offset (uint64), time (double))
+//
+// Capture samples the surface on the calling thread into a free slot of a
+// small ring; a writer thread derives the normals and writes the slot, so
+// the simulation only waits when the disk falls `queue_depth` frames behind.
+
+#include "wsw_core.h"
+#include "wsw_cache.h"
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace wsw {
+  struct HeightFieldHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t nx;
+    uint32_t ny;
+    uint32_t reserved;
+    uint64_t frame_stride;
+    uint64_t data_offset;
+    uint64_t frames;       // 0 until closed, see Frames()
+    uint64_t index_offset; // 0 until closed
+    double   x0, y0;       // world position of sample (0, 0)
+    double   dx, dy;
+  };
+  struct HeightFieldIndex {
+    uint64_t offset;
+    double   time;
+  };
+  struct HeightFieldFrame {
+    uint64_t frame;
+    double   time;
+    uint32_t nx;
+    uint32_t ny;
+    uint32_t reserved[10]; // heights start 64 bytes into the slot
+  };
+
+  class HeightFieldWriter {
+  public:
+    struct Settings {
+      int   nx          = 256;
+      int   ny          = 256;
+      Vec2  center      = Vec2(0);
+      Float half_extent = 50;    // of the sampled square
+      int   queue_depth = 3;     // slots in flight before Capture waits
+    };
+    // an unusable path leaves the writer !Ok(), and Capture a no-op
+    HeightFieldWriter(const std::string& path, const Settings& s);
+    ~HeightFieldWriter();
+    HeightFieldWriter(const HeightFieldWriter&) = delete;
+    HeightFieldWriter& operator=(const HeightFieldWriter&) = delete;
+    // samples grid.WaterSurface over the square as the next frame
+    void Capture(const WaveGrid& grid) { Capture(grid.Time(), [&](Vec2 pos) { return grid.WaterSurface(pos); }); }
+    // same for any surface(Vec2) -> Vec4 (x displacement, y displacement, height, unused)
+    template <class SurfaceFn>
+    void Capture(Float time, const SurfaceFn& surface);
+    // writes the queued frames and the index; false if any write failed
+    bool Close();
+    bool Ok() const { return m_file != nullptr; }
+    int  Frames() const { return (int)m_frames; }
+    // wall-clock seconds Capture spent sampling and waiting for a free slot
+    double SampleTime() const { return m_sampleTime; }
+    double StallTime()  const { return m_stallTime; }
+  private:
+    float* acquire(Float time);
+    void   submit();
+    void   writer_main();
+    void   encode_normals(unsigned char* slot) const;
+
+    Settings                       m_settings;
+    FILE*                          m_file;
+    HeightFieldHeader              m_header;
+    std::vector<AlignedVector<unsigned char>> m_slots;
+    std::vector<HeightFieldIndex>  m_index;   // per written frame, appended on close
+    std::thread                    m_writer;
+    std::mutex                     m_lock;
+    std::condition_variable        m_wake;
+    int                            m_queued;  // slots filled and not yet written
+    int                            m_head;    // next slot to fill
+    uint64_t                       m_frames;  // captured
+    bool                           m_quit;
+    bool                           m_failed;
+    double                         m_sampleTime;
+    double                         m_stallTime;
+  };
+
+  // Frame access for consumers: each frame is mapped on its own.
+  class HeightFieldReader {
+  public:
+    explicit HeightFieldReader(const std::string& path);
+    bool Ok() const { return m_ok; }
+    const HeightFieldHeader& Header() const { return m_header; }
+    // from the index if the file was closed, else the whole slots written so far
+    int  Frames() const;
+    // frame k alone, empty if k is out of range
+    std::unique_ptr<MappedFile> MapFrame(int k) const;
+    static const HeightFieldFrame& Frame(const MappedFile& f)   { return *(const HeightFieldFrame*)f.Data(); }
+    static const float*            Heights(const MappedFile& f) { return (const float*)(f.Data() + sizeof(HeightFieldFrame)); }
+    // normal (x, y) of sample i of the frame
+    static Vec2 Normal(const MappedFile& f, size_t i);
+  private:
+    std::string       m_path;
+    HeightFieldHeader m_header;
+    bool              m_ok;
+  };
+}
+
+template <class SurfaceFn>
+void wsw::HeightFieldWriter::Capture(Float time, const SurfaceFn& surface) {
+  float* heights = acquire(time);
+  if (!heights) {
+    return;
+  }
+  std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  for (int iy = 0; iy < m_settings.ny; iy++) {
+    for (int ix = 0; ix < m_settings.nx; ix++) {
+      Vec2 pos((Float)(m_header.x0 + ix * m_header.dx), (Float)(m_header.y0 + iy * m_header.dy));
+      heights[(size_t)iy * m_settings.nx + ix] = (float)surface(pos).z;
+    }
+  }
+  m_sampleTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  submit();
+}
+
+#endif // WSW_EXPORT_H
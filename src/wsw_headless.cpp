@@ -0,0 +1,262 @@
+// Headless driver: steps WaveGrid::TimeStep for N frames without a display.
+//   wsw_headless [--frames N] [--n_x N] [--n_theta N[,N..]] [--n_zeta N] [--dt DT] [--linear] [--tiled] [--simd scalar|sse2|avx2|avx512] [--threads N] [--tile N] [--cache DIR] [--sparse] [--calm] [--storage full|half|bf16] [--levels N] [--rate N] [--theta_stride N] [--theta_tol T] [--no_shift] [--no_stencils] [--band_courant C] [--max_band_period N] [--band_spacing W] [--band_cull F] [--huge_pages] [--spectrum linear|pm|jonswap|tma] [--wind U[,U..]] [--size M[,M..]] [--fetch M] [--depth M] [--export FILE] [--export_res N]
+#include "wsw_core.h"
+#include "wsw_lod.h"
+#include "wsw_ensemble.h"
+#include "wsw_export.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+
+namespace {
+  void usage(const char* exe) {
+    printf("usage: %s [--frames N] [--n_x N] [--n_theta N[,N..]] [--n_zeta N] [--dt DT] [--linear] [--tiled] [--simd scalar|sse2|avx2|avx512] [--threads N] [--tile N] [--cache DIR] [--sparse] [--calm] [--storage full|half|bf16] [--levels N] [--rate N] [--theta_stride N] [--theta_tol T] [--no_shift] [--no_stencils] [--band_courant C] [--max_band_period N] [--band_spacing W] [--band_cull F] [--huge_pages] [--spectrum linear|pm|jonswap|tma] [--wind U[,U..]] [--size M[,M..]] [--fetch M] [--depth M] [--export FILE] [--export_res N]\n", exe);
+  }
+  typedef std::chrono::steady_clock clock;
+
+  void print_export(wsw::HeightFieldWriter& writer, const std::string& path, int frames) {
+    bool ok = writer.Close();
+    wsw::HeightFieldReader reader(path);
+    printf("export   : %d frames of %u x %u to %s%s (%.1f MB/frame, %.3f ms/frame sampling, %.3f ms/frame waiting for the writer)\n",
+           reader.Frames(), reader.Header().nx, reader.Header().ny, path.c_str(), ok && reader.Ok() ? "" : " FAILED",
+           reader.Header().frame_stride / 1048576.0, frames ? writer.SampleTime() * 1e3 / frames : 0.0, frames ? writer.StallTime() * 1e3 / frames : 0.0);
+  }
+
+  int run_clipmap(const WaveGrid::Settings& s, int levels, int rate, int frames, Float dt, const std::string& path, int res) {
+    WaveClipmap::Settings c;
+    c.level  = s;
+    c.levels = levels;
+    c.rate   = rate;
+    clock::time_point t0 = clock::now();
+    WaveClipmap clipmap(c);
+    std::unique_ptr<wsw::HeightFieldWriter> writer;
+    if (!path.empty()) {
+      wsw::HeightFieldWriter::Settings e;
+      e.nx = e.ny   = res;
+      e.center      = s.center;
+      e.half_extent = clipmap.Level(levels - 1).GetSettings().size;
+      writer.reset(new wsw::HeightFieldWriter(path, e));
+    }
+    clock::time_point t1 = clock::now();
+    for (int frame = 0; frame < frames; frame++) {
+      clipmap.TimeStep(dt);
+      if (writer) {
+        writer->Capture(clipmap.Time(), [&](Vec2 pos) { return clipmap.WaterSurface(pos); });
+      }
+    }
+    clock::time_point t2 = clock::now();
+    double total_ms = std::chrono::duration<double, std::milli>(t2 - t1).count();
+    Vec4   center   = clipmap.WaterSurface(Vec2(-s.size * (Float)0.5, 0));
+    printf("clipmap  : %d levels of %d x %d x %d theta x %d zeta, %.0f m to %.0f m, every %d^l frames\n", levels, clipmap.Level(0).GetSettings().n_x,
+           clipmap.Level(0).GetSettings().n_x, s.n_theta, s.n_zeta, 2 * (double)s.size, 2 * (double)clipmap.Level(levels - 1).GetSettings().size, rate);
+    printf("cells    : %zu (uniform at level 0 spacing: %.0f)\n", clipmap.Cells(),
+           (double)clipmap.Level(0).Amplitude().Size() * std::pow(4.0, levels - 1));
+    printf("init     : %.3f ms\n", std::chrono::duration<double, std::milli>(t1 - t0).count());
+    printf("frames   : %d (%.3f ms/frame, %.3f ms/frame in restriction)\n", frames, frames ? total_ms / frames : 0.0,
+           frames ? clipmap.TransferTime() * 1e3 / frames : 0.0);
+    printf("sim time : %.3f s\n", (double)clipmap.Time());
+    printf("height   : %f\n", (double)center.z);
+    if (writer) {
+      print_export(*writer, path, frames);
+    }
+    return 0;
+  }
+
+  // every combination of the listed wind speeds, n_theta and sizes
+  int run_ensemble(const WaveGrid::Settings& s, const std::vector<double>& winds, const std::vector<double>& thetas,
+                   const std::vector<double>& sizes, int frames, Float dt) {
+    WaveEnsemble::Settings e;
+    e.threads = s.threads;
+    for (double wind : winds) {
+      for (double n_theta : thetas) {
+        for (double size : sizes) {
+          WaveGrid::Settings m = s;
+          m.spectrum.wind_speed = (Float)wind;
+          m.n_theta             = (int)n_theta;
+          m.size                = (Float)size;
+          e.members.push_back(m);
+        }
+      }
+    }
+    WaveEnsemble ensemble(e);
+    for (int frame = 0; frame < frames; frame++) {
+      ensemble.TimeStep(dt);
+    }
+    printf("ensemble : %d members (%zu winds x %zu n_theta x %zu sizes), %d spectra, %d profile table sets\n", ensemble.Members(),
+           winds.size(), thetas.size(), sizes.size(), ensemble.Spectra(), ensemble.TableOwners());
+    printf("init     : %.3f ms\n", ensemble.InitTime() * 1e3);
+    printf("frames   : %d (%.3f ms/frame)\n", frames, frames ? ensemble.StepTime() * 1e3 / frames : 0.0);
+    printf("sim time : %.3f s per member, %.3f s total\n", frames * (double)dt, ensemble.SimTime());
+    printf("speed    : %.1f sim-seconds per wall-second\n", ensemble.Throughput());
+    const WaveGrid& first = ensemble.Member(0);
+    printf("height   : %f (member 0)\n", (double)first.WaterSurface(Vec2(-first.GetSettings().size * (Float)0.5, 0)).z);
+    return 0;
+  }
+
+  // comma separated numbers, empty on a malformed list
+  std::vector<double> parse_list(const char* arg) {
+    std::vector<double> r;
+    for (const char* p = arg; *p;) {
+      char*  end;
+      double v = strtod(p, &end);
+      if (end == p) {
+        return std::vector<double>();
+      }
+      r.push_back(v);
+      p = (*end == ',') ? end + 1 : end;
+    }
+    return r;
+  }
+
+  WaveGrid::Settings::SpectrumType parse_spectrum(const char* name) {
+    if (!strcmp(name, "linear"))  { return WaveGrid::Settings::LinearBasis; }
+    if (!strcmp(name, "jonswap")) { return WaveGrid::Settings::Jonswap; }
+    if (!strcmp(name, "tma"))     { return WaveGrid::Settings::TMA; }
+    return WaveGrid::Settings::PiersonMoskowitz;
+  }
+
+  wsw::SimdIsa parse_simd(const char* name) {
+    for (int isa = wsw::Scalar; isa <= wsw::SimdAuto; isa++) {
+      if (!strcmp(name, wsw::simd_isa_name((wsw::SimdIsa)isa))) { return (wsw::SimdIsa)isa; }
+    }
+    return wsw::SimdAuto;
+  }
+};
+
+int main(int argc, char* argv[]) {
+  WaveGrid::Settings s;
+  int   frames = 100;
+  int   levels = 1;
+  int   rate   = 2;
+  Float dt     = (Float)(1.0 / 60.0);
+  std::string         export_path;
+  int                 export_res = 256;
+  std::vector<double> winds  = { (double)s.spectrum.wind_speed };
+  std::vector<double> thetas = { (double)s.n_theta };
+  std::vector<double> sizes  = { (double)s.size };
+  for (int i = 1; i < argc; i++) {
+    const char* arg  = argv[i];
+    const char* next = (i + 1 < argc) ? argv[i + 1] : nullptr;
+    if      (!strcmp(arg, "--frames")  && next) { frames    = atoi(next); i++; }
+    else if (!strcmp(arg, "--n_x")     && next) { s.n_x     = atoi(next); i++; }
+    else if (!strcmp(arg, "--n_theta") && next) { thetas    = parse_list(next); i++; }
+    else if (!strcmp(arg, "--size")    && next) { sizes     = parse_list(next); i++; }
+    else if (!strcmp(arg, "--n_zeta")  && next) { s.n_zeta  = atoi(next); i++; }
+    else if (!strcmp(arg, "--dt")      && next) { dt        = (Float)atof(next); i++; }
+    else if (!strcmp(arg, "--linear"))          { s.spectrumType = WaveGrid::Settings::LinearBasis; }
+    else if (!strcmp(arg, "--spectrum") && next) { s.spectrumType        = parse_spectrum(next); i++; }
+    else if (!strcmp(arg, "--wind")     && next) { winds                 = parse_list(next); i++; }
+    else if (!strcmp(arg, "--fetch")    && next) { s.spectrum.fetch      = (Float)atof(next); i++; }
+    else if (!strcmp(arg, "--depth")    && next) { s.spectrum.depth      = (Float)atof(next); i++; }
+    else if (!strcmp(arg, "--tiled"))           { s.layout = Grid::Tiled; }
+    else if (!strcmp(arg, "--simd")    && next) { s.simd     = parse_simd(next); i++; }
+    else if (!strcmp(arg, "--threads") && next) { s.threads  = atoi(next); i++; }
+    else if (!strcmp(arg, "--tile")    && next) { s.tile_size = atoi(next); i++; }
+    else if (!strcmp(arg, "--cache")   && next) { s.cache_dir = next; i++; }
+    else if (!strcmp(arg, "--sparse"))          { s.sparse     = true; }
+    else if (!strcmp(arg, "--no_shift"))        { s.uniform_shift = false; }
+    else if (!strcmp(arg, "--no_stencils"))     { s.cached_stencils = false; }
+    else if (!strcmp(arg, "--calm"))            { s.calm_start = true; }
+    else if (!strcmp(arg, "--huge_pages"))      { s.huge_pages = true; }
+    else if (!strcmp(arg, "--export")     && next) { export_path = next;       i++; }
+    else if (!strcmp(arg, "--export_res") && next) { export_res  = atoi(next); i++; }
+    else if (!strcmp(arg, "--theta_stride") && next) { s.max_theta_stride = atoi(next); i++; }
+    else if (!strcmp(arg, "--theta_tol")    && next) { s.theta_tolerance  = (Float)atof(next); i++; }
+    else if (!strcmp(arg, "--band_courant")    && next) { s.band_courant    = (Float)atof(next); i++; }
+    else if (!strcmp(arg, "--max_band_period") && next) { s.max_band_period = atoi(next); i++; }
+    else if (!strcmp(arg, "--band_spacing")    && next) { s.band_spacing    = (Float)atof(next); i++; }
+    else if (!strcmp(arg, "--band_cull")       && next) { s.band_cull_fraction = (Float)atof(next); i++; }
+    else if (!strcmp(arg, "--levels")  && next) { levels       = atoi(next); i++; }
+    else if (!strcmp(arg, "--rate")    && next) { rate         = atoi(next); i++; }
+    else if (!strcmp(arg, "--storage") && next) { s.storage    = !strcmp(next, "half") ? Grid::Half : !strcmp(next, "bf16") ? Grid::BFloat16 : Grid::Full; i++; }
+    else { usage(argv[0]); return 1; }
+  }
+  bool lists_ok = !winds.empty() && !thetas.empty() && !sizes.empty();
+  for (double v : winds)  { lists_ok = lists_ok && v > 0.0; }
+  for (double v : thetas) { lists_ok = lists_ok && v >= 1.0; }
+  for (double v : sizes)  { lists_ok = lists_ok && v > 0.0; }
+  if (!lists_ok || frames < 0 || s.n_x < 2 || s.n_zeta < 1 || s.tile_size < 1 || s.band_courant < (Float)0.0 || s.band_spacing < (Float)0.0 || s.band_cull_fraction < (Float)0.0 || s.max_band_period < 1 || dt <= (Float)0.0 || levels < 1 || rate < 1 || export_res < 2 ||
+      s.spectrum.fetch <= (Float)0.0 || s.spectrum.depth <= (Float)0.0) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (winds.size() * thetas.size() * sizes.size() > 1) {
+    return run_ensemble(s, winds, thetas, sizes, frames, dt);
+  }
+  s.spectrum.wind_speed = (Float)winds[0];
+  s.n_theta             = (int)thetas[0];
+  s.size                = (Float)sizes[0];
+  if (levels > 1) {
+    return run_clipmap(s, levels, rate, frames, dt, export_path, export_res);
+  }
+
+  clock::time_point t0 = clock::now();
+  WaveGrid grid(s);
+  std::unique_ptr<wsw::HeightFieldWriter> writer;
+  if (!export_path.empty()) {
+    wsw::HeightFieldWriter::Settings e;
+    e.nx = e.ny   = export_res;
+    e.center      = s.center;
+    e.half_extent = s.size;
+    writer.reset(new wsw::HeightFieldWriter(export_path, e));
+  }
+  clock::time_point t1 = clock::now();
+  std::string live, last;
+  for (int frame = 0; frame < frames; frame++) {
+    grid.TimeStep(dt);
+    if (s.band_cull_fraction > (Float)0.0) {
+      live.clear();
+      for (const WaveGrid::BandTimings& b : grid.GetBandTimings()) {
+        live += b.live ? '#' : '.';
+      }
+      if (live != last) {
+        printf("live     : frame %d, bands %s (%d of %d)\n", frame, live.c_str(), grid.LiveBands(), s.n_zeta);
+        last = live;
+      }
+    }
+    if (writer) {
+      writer->Capture(grid);
+    }
+  }
+  clock::time_point t2 = clock::now();
+
+  double init_ms  = std::chrono::duration<double, std::milli>(t1 - t0).count();
+  double total_ms = std::chrono::duration<double, std::milli>(t2 - t1).count();
+  Vec4   center   = grid.WaterSurface(Vec2(-s.size * (Float)0.5, 0));
+  const char* storage = (s.storage == Grid::Half) ? "half" : (s.storage == Grid::BFloat16) ? "bf16" : sizeof(Float) == 4 ? "float" : "double";
+  printf("grid     : %d x %d x %d theta x %d zeta (%s, %s, %.1f MB%s)\n", s.n_x, s.n_x, s.n_theta, s.n_zeta, storage, wsw::simd_isa_name(grid.ActiveSimd()),
+         grid.Amplitude().Bytes() / 1048576.0, grid.Amplitude().HugePages() ? ", huge pages" : "");
+  printf("init     : %.3f ms (profile tables %.3f ms, %s)\n", init_ms, grid.ProfileStartupTime() * 1e3,
+         s.cache_dir.empty() ? "cache disabled" : grid.ProfileCacheHit() ? "cache hit" : grid.ProfileCacheSaved() ? "cache miss" : "cache miss, cannot write it");
+  printf("frames   : %d (%.3f ms/frame)\n", frames, frames ? total_ms / frames : 0.0);
+  printf("tiles    : %d of %d active (%.1f per frame)\n", grid.ActiveTiles(), grid.TileCount(),
+         frames ? (double)grid.GetTimings().tiles / frames : 0.0);
+  printf("cells    : %.0f of %.0f per frame stepped, %.0f by the uniform shift\n", frames ? (double)grid.GetTimings().cells / frames : 0.0,
+         (double)s.n_x * s.n_x * s.n_theta * s.n_zeta, frames ? (double)grid.GetTimings().shifted / frames : 0.0);
+  printf("stencils : %.1f MB, built %d times in %.3f ms\n", grid.StencilBytes() / 1048576.0, grid.GetTimings().stencil_builds,
+         grid.GetTimings().stencils * 1e3);
+  for (int izeta = 0; izeta < s.n_zeta; izeta++) {
+    const WaveGrid::BandTimings& b = grid.GetBandTimings()[izeta];
+    printf("band %-3d : %d x %d nodes, %lld steps (%d substeps every %d frames), %.3f ms/frame", izeta, grid.Amplitude().GetBand(izeta).n_x,
+           grid.Amplitude().GetBand(izeta).n_y, b.steps, b.substeps, b.period, frames ? b.seconds * 1e3 / frames : 0.0);
+    if (s.band_cull_fraction > (Float)0.0) {
+      printf(", live %lld of %d frames (%.2g of the energy, %.2g of the inflow)", b.live_calls, frames, b.share, b.inflow);
+    }
+    printf("\n");
+  }
+  if (s.band_cull_fraction > (Float)0.0) {
+    long long calls = 0;
+    for (const WaveGrid::BandTimings& b : grid.GetBandTimings()) {
+      calls += b.live_calls;
+    }
+    printf("bands    : %.2f of %d live per frame, %.3f ms/frame measuring their energy\n", frames ? (double)calls / frames : 0.0, s.n_zeta,
+           frames ? grid.GetTimings().energy * 1e3 / frames : 0.0);
+  }
+  printf("sim time : %.3f s\n", (double)grid.Time());
+  printf("height   : %f\n", (double)center.z);
+  if (writer) {
+    print_export(*writer, export_path, frames);
+  }
+  return 0;
+}
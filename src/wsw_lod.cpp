@@ -0,0 +1,80 @@
+#include "wsw_lod.h"
+#include "wsw_thread_pool.h"
+#include <chrono>
+
+namespace {
+  typedef std::chrono::steady_clock clock;
+  double seconds_since(clock::time_point t0) {
+    return std::chrono::duration<double>(clock::now() - t0).count();
+  }
+};
+
+// Every level shares level 0's center, so with an even n_x the cell of a
+// coarse node is exactly 2 x 2 fine cells. The levels also share the
+// spectrum, which does not depend on the extent.
+WaveClipmap::WaveClipmap(const Settings& s) : m_settings(s), m_pool(new ThreadPool(s.level.threads)), m_calls(0), m_stepTime(0.0), m_transferTime(0.0) {
+  m_settings.levels = std::max(s.levels, 1);
+  m_settings.rate   = std::max(s.rate, 1);
+  WaveGrid::Settings level = s.level;
+  level.n_x        = (s.level.n_x + 1) & ~1;
+  level.scene_size = (s.level.scene_size > (Float)0.0) ? s.level.scene_size : s.level.size;
+  Spectrum  spectrum = WaveGrid::MakeSpectrum(level);
+  long long period   = 1;
+  for (int l = 0; l < m_settings.levels; l++) {
+    m_levels.emplace_back(new WaveGrid(level, spectrum, nullptr, m_pool.get()));
+    m_period.push_back(period);
+    level.size *= 2;
+    period     *= m_settings.rate;
+  }
+  for (int l = 0; l + 1 < Levels(); l++) {
+    m_levels[l]->SetInflow(m_levels[l + 1].get());
+  }
+}
+
+WaveClipmap::~WaveClipmap() {
+}
+
+void WaveClipmap::TimeStep(Float dt) {
+  m_calls++;
+  clock::time_point t = clock::now();
+  for (int l = 0; l < Levels(); l++) {
+    if (m_calls % m_period[l] == 0) {
+      m_levels[l]->TimeStep(dt * (Float)m_period[l]);
+    }
+  }
+  m_stepTime += seconds_since(t);
+  t = clock::now();
+  // a level that stepped is level 0's time again, as is every finer one
+  for (int l = 0; l + 1 < Levels(); l++) {
+    if (m_calls % m_period[l + 1] == 0) {
+      m_levels[l + 1]->RestrictFrom(*m_levels[l], m_levels[l]->GetSettings().size * m_settings.blend_end);
+    }
+  }
+  m_transferTime += seconds_since(t);
+}
+
+Vec4 WaveClipmap::WaterSurface(Vec2 pos) const {
+  const std::vector<ProfileBuffer>& profiles = m_levels[0]->ProfileBuffers();
+  Vec2  d = pos - m_settings.level.center;
+  Float r = std::max(std::abs(d.x), std::abs(d.y));
+  for (int l = 0; l + 1 < Levels(); l++) {
+    Float size = m_levels[l]->GetSettings().size;
+    if (r <= m_settings.blend_begin * size) {
+      return m_levels[l]->WaterSurface(pos, profiles);
+    }
+    if (r < m_settings.blend_end * size) {
+      Float w = (r / size - m_settings.blend_begin) / (m_settings.blend_end - m_settings.blend_begin);
+      w = w * w * (3 - 2 * w);
+      return ((Float)1.0 - w) * m_levels[l]->WaterSurface(pos, profiles) + w * m_levels[l + 1]->WaterSurface(pos, profiles);
+    }
+  }
+  return m_levels.back()->WaterSurface(pos, profiles);
+}
+
+size_t WaveClipmap::Cells() const {
+  size_t cells = 0;
+  for (const std::unique_ptr<WaveGrid>& level : m_levels) {
+    cells += level->Amplitude().Size();
+  }
+  return cells;
+}
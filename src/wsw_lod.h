@@ -0,0 +1,51 @@
+#ifndef WSW_LOD_H
+#define WSW_LOD_H
+
+// Nested WaveGrids of doubling extent around one center (a clipmap). Level 0
+// resolves the surface near the camera and every further level covers twice
+// the extent with the same number of nodes, so memory and work grow with the
+// log of the domain size instead of its square.
+//
+// Level l steps every rate^l calls of TimeStep, with rate^l times the time
+// step, and catches up with level 0 on the calls it steps. The levels step
+// one after the other on one thread pool. Waves enter a
+// level through its boundary from the next coarser one, and after a step
+// every level's amplitudes are restricted into the coarser level under it.
+
+#include "wsw_core.h"
+
+class WaveClipmap {
+public:
+  struct Settings {
+    WaveGrid::Settings level;  // level 0; n_x is rounded up to even
+    int                levels = 4;
+    int                rate   = 2;
+    // a level hands over to the next between these fractions of its extent
+    Float              blend_begin = (Float)0.8;
+    Float              blend_end   = (Float)0.9;
+  };
+  explicit WaveClipmap(const Settings& s);
+  ~WaveClipmap();
+  void TimeStep(Float dt);
+  // surface at the world position pos from the finest level covering it,
+  // blended across level boundaries; the profile tables are level 0's
+  Vec4  WaterSurface(Vec2 pos) const;
+  Float Time() const { return m_levels[0]->Time(); }
+  int   Levels() const { return (int)m_levels.size(); }
+  const WaveGrid& Level(int l) const { return *m_levels[l]; }
+  // amplitude values over all levels
+  size_t Cells() const;
+  // wall-clock seconds of level stepping and of the restrictions, accumulated over TimeStep calls
+  double StepTime()     const { return m_stepTime; }
+  double TransferTime() const { return m_transferTime; }
+private:
+  Settings                               m_settings;
+  std::unique_ptr<ThreadPool>            m_pool;   // of level.threads, shared by the levels
+  std::vector<std::unique_ptr<WaveGrid>> m_levels;
+  std::vector<long long>                 m_period; // calls between steps of each level
+  long long                              m_calls;
+  double                                 m_stepTime;
+  double                                 m_transferTime;
+};
+
+#endif // WSW_LOD_H
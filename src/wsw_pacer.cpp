@@ -0,0 +1,58 @@
+#include "wsw_pacer.h"
+#include <algorithm>
+#include <thread>
+
+FramePacer::FramePacer(const Settings& s) : m_settings(s), m_accumulator(0.0), m_steps(0), m_sleepTime(0.0), m_droppedTime(0.0) {
+  m_settings.dt        = (s.dt > 0.0) ? s.dt : 1.0 / 60.0;
+  m_settings.max_steps = std::max(s.max_steps, 1);
+  Reset();
+}
+
+void FramePacer::Reset() {
+  m_last        = clock::now();
+  m_lastFrame   = m_last;
+  m_accumulator = 0.0;
+}
+
+void FramePacer::SetMode(Mode mode) {
+  m_settings.mode = mode;
+  Reset();
+}
+
+int FramePacer::Advance() {
+  if (m_settings.mode == AsFastAsPossible) {
+    m_steps++;
+    return 1;
+  }
+  clock::time_point now = clock::now();
+  m_accumulator += std::chrono::duration<double>(now - m_last).count();
+  m_last = now;
+  int steps = (int)(m_accumulator / m_settings.dt);
+  if (steps > m_settings.max_steps) {
+    m_droppedTime += (steps - m_settings.max_steps) * m_settings.dt;
+    m_accumulator -= (steps - m_settings.max_steps) * m_settings.dt;
+    steps = m_settings.max_steps;
+  }
+  m_accumulator -= steps * m_settings.dt;
+  m_steps       += steps;
+  return steps;
+}
+
+double FramePacer::Alpha() const {
+  return (m_settings.mode == AsFastAsPossible) ? 1.0 : std::min(std::max(m_accumulator / m_settings.dt, 0.0), 1.0);
+}
+
+void FramePacer::Wait() {
+  if (m_settings.mode == AsFastAsPossible) {
+    return;
+  }
+  clock::time_point step  = m_last + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(m_settings.dt - m_accumulator));
+  clock::time_point frame = m_lastFrame + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(m_settings.frame_interval));
+  clock::time_point due   = (m_settings.frame_interval > 0.0) ? std::min(step, frame) : step;
+  clock::time_point now   = clock::now();
+  if (due > now) {
+    std::this_thread::sleep_until(due);
+    m_sleepTime += std::chrono::duration<double>(clock::now() - now).count();
+  }
+  m_lastFrame = clock::now();
+}
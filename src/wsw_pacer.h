@@ -0,0 +1,58 @@
+#ifndef WSW_PACER_H
+#define WSW_PACER_H
+
+// Fixed-timestep pacing of a simulation driven by a render loop.
+//
+// Wall time since the last Advance goes into an accumulator that is drained
+// in whole steps of dt, so the simulation runs at real time whatever the
+// frame rate. Between steps, Alpha() is how far the display is past the
+// last one, in steps, for blending the last two states. Wait() sleeps on a
+// steady_clock deadline until the next step (or frame) is due instead of
+// polling. AsFastAsPossible runs one step per Advance and never sleeps, for
+// offline runs and recording.
+
+#include <chrono>
+
+class FramePacer {
+public:
+  enum Mode {
+    RealTime,
+    AsFastAsPossible
+  };
+  struct Settings {
+    double dt             = 1.0 / 60.0;
+    Mode   mode           = RealTime;
+    // steps per Advance at most; a longer stall is dropped instead of
+    // making the following frames slower still
+    int    max_steps      = 4;
+    // render at most this often (0: once per step)
+    double frame_interval = 0.0;
+  };
+  typedef std::chrono::steady_clock clock;
+  explicit FramePacer(const Settings& s);
+  // steps due since the last call
+  int    Advance();
+  // fraction of a step since the last one, in [0, 1); 1 when AsFastAsPossible
+  double Alpha() const;
+  // sleeps until the next step or frame is due; returns at once AsFastAsPossible
+  void   Wait();
+  void   SetMode(Mode mode);
+  Mode   GetMode() const { return m_settings.mode; }
+  // restarts the accumulator, e.g. after a pause
+  void   Reset();
+  const Settings& GetSettings() const { return m_settings; }
+  long long Steps()       const { return m_steps; }
+  // wall-clock seconds slept in Wait, and simulated seconds dropped by max_steps
+  double    SleepTime()   const { return m_sleepTime; }
+  double    DroppedTime() const { return m_droppedTime; }
+private:
+  Settings          m_settings;
+  clock::time_point m_last;        // of the last Advance
+  clock::time_point m_lastFrame;   // of the last Wait
+  double            m_accumulator; // seconds not yet stepped
+  long long         m_steps;
+  double            m_sleepTime;
+  double            m_droppedTime;
+};
+
+#endif // WSW_PACER_H
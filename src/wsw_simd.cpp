@@ -0,0 +1,260 @@
+#include "wsw_simd.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define WSW_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(_MSC_VER) && !defined(__clang__)
+#define WSW_TARGET(isa)
+#else
+#define WSW_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+namespace wsw {
+
+#if WSW_SIMD_X86
+// Each instruction set gets its own namespace with a lane type V and its own
+// copy of the kernels, compiled for that target only.
+
+namespace sse2 {
+#define WSW_SIMD_TARGET WSW_TARGET("sse2")
+#if !(USE_DOUBLE)
+  struct V {
+    enum { width = 4 };
+    typedef __m128 F;
+    typedef __m128 M;
+    static WSW_SIMD_TARGET F        set1(Float x)                 { return _mm_set1_ps(x); }
+    static WSW_SIMD_TARGET F        ramp()                        { return _mm_setr_ps(0, 1, 2, 3); }
+    static WSW_SIMD_TARGET F        loadu(const Float* p)         { return _mm_loadu_ps(p); }
+    static WSW_SIMD_TARGET void     storeu(Float* p, F x)         { _mm_storeu_ps(p, x); }
+    static WSW_SIMD_TARGET F        add(F a, F b)                 { return _mm_add_ps(a, b); }
+    static WSW_SIMD_TARGET F        sub(F a, F b)                 { return _mm_sub_ps(a, b); }
+    static WSW_SIMD_TARGET F        mul(F a, F b)                 { return _mm_mul_ps(a, b); }
+    static WSW_SIMD_TARGET F        div(F a, F b)                 { return _mm_div_ps(a, b); }
+    static WSW_SIMD_TARGET F        min(F a, F b)                 { return _mm_min_ps(a, b); }
+    static WSW_SIMD_TARGET F        max(F a, F b)                 { return _mm_max_ps(a, b); }
+    static WSW_SIMD_TARGET F        trunc(F x)                    { return _mm_cvtepi32_ps(_mm_cvttps_epi32(x)); }
+    static WSW_SIMD_TARGET M        ge(F a, F b)                  { return _mm_cmpge_ps(a, b); }
+    static WSW_SIMD_TARGET M        and_(M a, M b)                { return _mm_and_ps(a, b); }
+    static WSW_SIMD_TARGET unsigned bits(M m)                     { return (unsigned)_mm_movemask_ps(m); }
+    static WSW_SIMD_TARGET F        select(M m, F a, F b)         { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+    // no hardware gather before AVX2
+    static WSW_SIMD_TARGET F        gather(const Float* base, F x, F y, int stride) {
+      __m128i ix = _mm_cvttps_epi32(x), iy = _mm_cvttps_epi32(y);
+      alignas(16) int xs[4], ys[4];
+      _mm_store_si128((__m128i*)xs, ix);
+      _mm_store_si128((__m128i*)ys, iy);
+      return _mm_setr_ps(base[xs[0] + stride * ys[0]], base[xs[1] + stride * ys[1]], base[xs[2] + stride * ys[2]], base[xs[3] + stride * ys[3]]);
+    }
+  };
+#else
+  struct V {
+    enum { width = 2 };
+    typedef __m128d F;
+    typedef __m128d M;
+    static WSW_SIMD_TARGET F        set1(Float x)                 { return _mm_set1_pd(x); }
+    static WSW_SIMD_TARGET F        ramp()                        { return _mm_setr_pd(0, 1); }
+    static WSW_SIMD_TARGET F        loadu(const Float* p)         { return _mm_loadu_pd(p); }
+    static WSW_SIMD_TARGET void     storeu(Float* p, F x)         { _mm_storeu_pd(p, x); }
+    static WSW_SIMD_TARGET F        add(F a, F b)                 { return _mm_add_pd(a, b); }
+    static WSW_SIMD_TARGET F        sub(F a, F b)                 { return _mm_sub_pd(a, b); }
+    static WSW_SIMD_TARGET F        mul(F a, F b)                 { return _mm_mul_pd(a, b); }
+    static WSW_SIMD_TARGET F        div(F a, F b)                 { return _mm_div_pd(a, b); }
+    static WSW_SIMD_TARGET F        min(F a, F b)                 { return _mm_min_pd(a, b); }
+    static WSW_SIMD_TARGET F        max(F a, F b)                 { return _mm_max_pd(a, b); }
+    static WSW_SIMD_TARGET F        trunc(F x)                    { return _mm_cvtepi32_pd(_mm_cvttpd_epi32(x)); }
+    static WSW_SIMD_TARGET M        ge(F a, F b)                  { return _mm_cmpge_pd(a, b); }
+    static WSW_SIMD_TARGET M        and_(M a, M b)                { return _mm_and_pd(a, b); }
+    static WSW_SIMD_TARGET unsigned bits(M m)                     { return (unsigned)_mm_movemask_pd(m); }
+    static WSW_SIMD_TARGET F        select(M m, F a, F b)         { return _mm_or_pd(_mm_and_pd(m, a), _mm_andnot_pd(m, b)); }
+    static WSW_SIMD_TARGET F        gather(const Float* base, F x, F y, int stride) {
+      alignas(16) int xs[4], ys[4];
+      _mm_store_si128((__m128i*)xs, _mm_cvttpd_epi32(x));
+      _mm_store_si128((__m128i*)ys, _mm_cvttpd_epi32(y));
+      return _mm_setr_pd(base[xs[0] + stride * ys[0]], base[xs[1] + stride * ys[1]]);
+    }
+  };
+#endif
+#include "wsw_advect_row.inl"
+#undef WSW_SIMD_TARGET
+}
+
+namespace avx2 {
+#define WSW_SIMD_TARGET WSW_TARGET("avx2")
+#if !(USE_DOUBLE)
+  struct V {
+    enum { width = 8 };
+    typedef __m256 F;
+    typedef __m256 M;
+    static WSW_SIMD_TARGET F        set1(Float x)                 { return _mm256_set1_ps(x); }
+    static WSW_SIMD_TARGET F        ramp()                        { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+    static WSW_SIMD_TARGET F        loadu(const Float* p)         { return _mm256_loadu_ps(p); }
+    static WSW_SIMD_TARGET void     storeu(Float* p, F x)         { _mm256_storeu_ps(p, x); }
+    static WSW_SIMD_TARGET F        add(F a, F b)                 { return _mm256_add_ps(a, b); }
+    static WSW_SIMD_TARGET F        sub(F a, F b)                 { return _mm256_sub_ps(a, b); }
+    static WSW_SIMD_TARGET F        mul(F a, F b)                 { return _mm256_mul_ps(a, b); }
+    static WSW_SIMD_TARGET F        div(F a, F b)                 { return _mm256_div_ps(a, b); }
+    static WSW_SIMD_TARGET F        min(F a, F b)                 { return _mm256_min_ps(a, b); }
+    static WSW_SIMD_TARGET F        max(F a, F b)                 { return _mm256_max_ps(a, b); }
+    static WSW_SIMD_TARGET F        trunc(F x)                    { return _mm256_round_ps(x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+    static WSW_SIMD_TARGET M        ge(F a, F b)                  { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    static WSW_SIMD_TARGET M        and_(M a, M b)                { return _mm256_and_ps(a, b); }
+    static WSW_SIMD_TARGET unsigned bits(M m)                     { return (unsigned)_mm256_movemask_ps(m); }
+    static WSW_SIMD_TARGET F        select(M m, F a, F b)         { return _mm256_blendv_ps(b, a, m); }
+    static WSW_SIMD_TARGET F        gather(const Float* base, F x, F y, int stride) {
+      __m256i idx = _mm256_add_epi32(_mm256_cvttps_epi32(x), _mm256_mullo_epi32(_mm256_cvttps_epi32(y), _mm256_set1_epi32(stride)));
+      return _mm256_i32gather_ps(base, idx, 4);
+    }
+  };
+#else
+  struct V {
+    enum { width = 4 };
+    typedef __m256d F;
+    typedef __m256d M;
+    static WSW_SIMD_TARGET F        set1(Float x)                 { return _mm256_set1_pd(x); }
+    static WSW_SIMD_TARGET F        ramp()                        { return _mm256_setr_pd(0, 1, 2, 3); }
+    static WSW_SIMD_TARGET F        loadu(const Float* p)         { return _mm256_loadu_pd(p); }
+    static WSW_SIMD_TARGET void     storeu(Float* p, F x)         { _mm256_storeu_pd(p, x); }
+    static WSW_SIMD_TARGET F        add(F a, F b)                 { return _mm256_add_pd(a, b); }
+    static WSW_SIMD_TARGET F        sub(F a, F b)                 { return _mm256_sub_pd(a, b); }
+    static WSW_SIMD_TARGET F        mul(F a, F b)                 { return _mm256_mul_pd(a, b); }
+    static WSW_SIMD_TARGET F        div(F a, F b)                 { return _mm256_div_pd(a, b); }
+    static WSW_SIMD_TARGET F        min(F a, F b)                 { return _mm256_min_pd(a, b); }
+    static WSW_SIMD_TARGET F        max(F a, F b)                 { return _mm256_max_pd(a, b); }
+    static WSW_SIMD_TARGET F        trunc(F x)                    { return _mm256_round_pd(x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+    static WSW_SIMD_TARGET M        ge(F a, F b)                  { return _mm256_cmp_pd(a, b, _CMP_GE_OQ); }
+    static WSW_SIMD_TARGET M        and_(M a, M b)                { return _mm256_and_pd(a, b); }
+    static WSW_SIMD_TARGET unsigned bits(M m)                     { return (unsigned)_mm256_movemask_pd(m); }
+    static WSW_SIMD_TARGET F        select(M m, F a, F b)         { return _mm256_blendv_pd(b, a, m); }
+    static WSW_SIMD_TARGET F        gather(const Float* base, F x, F y, int stride) {
+      __m128i idx = _mm_add_epi32(_mm256_cvttpd_epi32(x), _mm_mullo_epi32(_mm256_cvttpd_epi32(y), _mm_set1_epi32(stride)));
+      return _mm256_i32gather_pd(base, idx, 8);
+    }
+  };
+#endif
+#include "wsw_advect_row.inl"
+#undef WSW_SIMD_TARGET
+}
+
+// GCC 12 flags the undefined upper lanes the AVX-512 intrinsics start from
+// (_mm512_undefined_*) as maybe uninitialized once inlined here
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+namespace avx512 {
+#define WSW_SIMD_TARGET WSW_TARGET("avx512f")
+#if !(USE_DOUBLE)
+  struct V {
+    enum { width = 16 };
+    typedef __m512    F;
+    typedef __mmask16 M;
+    static WSW_SIMD_TARGET F        set1(Float x)                 { return _mm512_set1_ps(x); }
+    static WSW_SIMD_TARGET F        ramp()                        { return _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15); }
+    static WSW_SIMD_TARGET F        loadu(const Float* p)         { return _mm512_loadu_ps(p); }
+    static WSW_SIMD_TARGET void     storeu(Float* p, F x)         { _mm512_storeu_ps(p, x); }
+    static WSW_SIMD_TARGET F        add(F a, F b)                 { return _mm512_add_ps(a, b); }
+    static WSW_SIMD_TARGET F        sub(F a, F b)                 { return _mm512_sub_ps(a, b); }
+    static WSW_SIMD_TARGET F        mul(F a, F b)                 { return _mm512_mul_ps(a, b); }
+    static WSW_SIMD_TARGET F        div(F a, F b)                 { return _mm512_div_ps(a, b); }
+    static WSW_SIMD_TARGET F        min(F a, F b)                 { return _mm512_min_ps(a, b); }
+    static WSW_SIMD_TARGET F        max(F a, F b)                 { return _mm512_max_ps(a, b); }
+    static WSW_SIMD_TARGET F        trunc(F x)                    { return _mm512_roundscale_ps(x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+    static WSW_SIMD_TARGET M        ge(F a, F b)                  { return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ); }
+    static WSW_SIMD_TARGET M        and_(M a, M b)                { return (M)(a & b); }
+    static WSW_SIMD_TARGET unsigned bits(M m)                     { return (unsigned)m; }
+    static WSW_SIMD_TARGET F        select(M m, F a, F b)         { return _mm512_mask_blend_ps(m, b, a); }
+    static WSW_SIMD_TARGET F        gather(const Float* base, F x, F y, int stride) {
+      __m512i idx = _mm512_add_epi32(_mm512_cvttps_epi32(x), _mm512_mullo_epi32(_mm512_cvttps_epi32(y), _mm512_set1_epi32(stride)));
+      return _mm512_i32gather_ps(idx, base, 4);
+    }
+  };
+#else
+  struct V {
+    enum { width = 8 };
+    typedef __m512d  F;
+    typedef __mmask8 M;
+    static WSW_SIMD_TARGET F        set1(Float x)                 { return _mm512_set1_pd(x); }
+    static WSW_SIMD_TARGET F        ramp()                        { return _mm512_setr_pd(0, 1, 2, 3, 4, 5, 6, 7); }
+    static WSW_SIMD_TARGET F        loadu(const Float* p)         { return _mm512_loadu_pd(p); }
+    static WSW_SIMD_TARGET void     storeu(Float* p, F x)         { _mm512_storeu_pd(p, x); }
+    static WSW_SIMD_TARGET F        add(F a, F b)                 { return _mm512_add_pd(a, b); }
+    static WSW_SIMD_TARGET F        sub(F a, F b)                 { return _mm512_sub_pd(a, b); }
+    static WSW_SIMD_TARGET F        mul(F a, F b)                 { return _mm512_mul_pd(a, b); }
+    static WSW_SIMD_TARGET F        div(F a, F b)                 { return _mm512_div_pd(a, b); }
+    static WSW_SIMD_TARGET F        min(F a, F b)                 { return _mm512_min_pd(a, b); }
+    static WSW_SIMD_TARGET F        max(F a, F b)                 { return _mm512_max_pd(a, b); }
+    static WSW_SIMD_TARGET F        trunc(F x)                    { return _mm512_roundscale_pd(x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+    static WSW_SIMD_TARGET M        ge(F a, F b)                  { return _mm512_cmp_pd_mask(a, b, _CMP_GE_OQ); }
+    static WSW_SIMD_TARGET M        and_(M a, M b)                { return (M)(a & b); }
+    static WSW_SIMD_TARGET unsigned bits(M m)                     { return (unsigned)m; }
+    static WSW_SIMD_TARGET F        select(M m, F a, F b)         { return _mm512_mask_blend_pd(m, b, a); }
+    static WSW_SIMD_TARGET F        gather(const Float* base, F x, F y, int stride) {
+      __m256i idx = _mm256_add_epi32(_mm512_cvttpd_epi32(x), _mm256_mullo_epi32(_mm512_cvttpd_epi32(y), _mm256_set1_epi32(stride)));
+      return _mm512_i32gather_pd(idx, base, 8);
+    }
+  };
+#endif
+#include "wsw_advect_row.inl"
+#undef WSW_SIMD_TARGET
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif // WSW_SIMD_X86
+
+SimdIsa best_simd_isa() {
+#if WSW_SIMD_X86
+#if defined(_MSC_VER) && !defined(__clang__)
+  int info[4];
+  __cpuid(info, 1);
+  unsigned long long xcr0 = (info[2] & (1 << 27)) ? _xgetbv(0) : 0; // OSXSAVE
+  __cpuidex(info, 7, 0);
+  if ((info[1] & (1 << 16)) && (xcr0 & 0xe6) == 0xe6) { return AVX512; }
+  if ((info[1] & (1 <<  5)) && (xcr0 & 0x06) == 0x06) { return AVX2; }
+#else
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) { return AVX512; }
+  if (__builtin_cpu_supports("avx2"))    { return AVX2; }
+#endif
+  return SSE2;
+#else
+  return Scalar;
+#endif
+}
+
+// AVX-512 gives the same result as the other kernels, but it was no faster
+// than AVX2 on the gather-bound kernel (wsw_bench, n_x 400) and on many
+// parts it lowers the core clock for the rest of the step as well, so it
+// is only used when asked for
+SimdIsa default_simd_isa() {
+  return std::min(best_simd_isa(), AVX2);
+}
+
+const char* simd_isa_name(SimdIsa isa) {
+  switch (isa) {
+  case SSE2:     return "sse2";
+  case AVX2:     return "avx2";
+  case AVX512:   return "avx512";
+  case SimdAuto: return "auto";
+  default:       return "scalar";
+  }
+}
+
+AdvectRowFn advect_row_kernel(SimdIsa isa) {
+#if WSW_SIMD_X86
+  switch (isa) {
+  case SSE2:   return sse2::advect_row;
+  case AVX2:   return avx2::advect_row;
+  case AVX512: return avx512::advect_row;
+  default:     break;
+  }
+#endif
+  (void)isa;
+  return nullptr;
+}
+
+}
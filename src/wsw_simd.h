@@ -0,0 +1,36 @@
+#ifndef WSW_SIMD_H
+#define WSW_SIMD_H
+
+// Explicitly vectorized kernels of wsw_core, one copy per instruction set.
+// Internal to the library; the public knob is WaveGrid::Settings::simd.
+
+#include "wsw_core.h"
+
+namespace wsw {
+  // nodes [begin, end) of one x-row of a (theta, zeta) slice of the Linear layout
+  struct AdvectRow {
+    const Float* slice;    // amplitude slice, x fastest, row stride n
+    const Float* speed;    // group speed of the row's nodes
+    const Float* levelset; // shore distance of the row's nodes
+    int          n;
+    int          begin;
+    int          end;
+    Float        size;
+    Float        dx;
+    int          iy;       // the row
+    Float        y;        // node y of the row
+    Float        dir_x;
+    Float        dir_y;
+    Float        dt;
+    Float        ambient;  // inflow amplitude through the domain boundary
+    unsigned     outside;  // ~0u to leave backtraces out of the domain to the caller, else 0
+  };
+  // An AdvectRowFn writes the advected amplitude of node begin + i of the row
+  // to out[i] and sets slow[i] for the nodes whose backtrace may hit the
+  // shore; the caller recomputes those with the scalar reflecting path.
+
+  // nullptr for Scalar or an instruction set this build cannot target
+  AdvectRowFn advect_row_kernel(SimdIsa isa);
+}
+
+#endif // WSW_SIMD_H
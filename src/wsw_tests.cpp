@@ -0,0 +1,304 @@
+// Regression tests for the wsw_core solver, run by ctest.
+//   wsw_tests [--steps N] [--n_x N] [--n_theta N]
+// Every setting that claims the same result as its reference must match it
+// exactly; the approximations must stay within the bounds they document.
+// Exits with 1 if any check fails.
+#include "wsw_core.h"
+#include "wsw_ensemble.h"
+#include "wsw_alloc_counter.h"
+#include "wsw_compare.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace {
+  const Float Dt = (Float)(1.0 / 60.0);
+
+  int g_failures = 0;
+
+  // one check: value must be at most bound (0: exactly 0)
+  void check(const char* name, double value, double bound) {
+    bool ok = value <= bound;
+    g_failures += ok ? 0 : 1;
+    printf("%-4s %-52s %-12g bound %g\n", ok ? "ok" : "FAIL", name, value, bound);
+  }
+
+  // Builds a grid from each of a and b, steps both by dt and compares them,
+  // b being the reference: the largest |amplitude difference| where both
+  // store bands at the same sizes (-1 otherwise) and of the surface, each
+  // with the reference's peak. Then `more` may check anything else of them.
+  struct Difference {
+    double amplitude      = -1;
+    double amplitude_peak = 0;
+    double height         = 0;
+    double height_peak    = 0;
+  };
+  Difference compare(WaveGrid::Settings a, WaveGrid::Settings b, int steps, Float dt = Dt,
+                     const std::function<void(const WaveGrid& grid, const WaveGrid& reference)>& more = nullptr) {
+    WaveGrid grid(a);
+    WaveGrid reference(b);
+    for (int i = 0; i < steps; i++) {
+      grid.TimeStep(dt);
+      reference.TimeStep(dt);
+    }
+    Difference d;
+    bool same = true;
+    for (int izeta = 0; izeta < b.n_zeta; izeta++) {
+      same = same && grid.Amplitude().GetBand(izeta).n_x == reference.Amplitude().GetBand(izeta).n_x;
+    }
+    if (same) {
+      reference.Amplitude().ForEachCell<Grid::Linear>([&](int ix, int iy, int itheta, int izeta) {
+        d.amplitude_peak = std::max(d.amplitude_peak, (double)std::abs(reference.Amplitude()(ix, iy, itheta, izeta)));
+      });
+      d.amplitude = (double)wsw::max_difference(grid.Amplitude(), reference.Amplitude());
+    }
+    d.height = wsw::height_difference(grid, reference, d.height_peak);
+    if (more) {
+      more(grid, reference);
+    }
+    return d;
+  }
+
+  const char* layout_name(Grid::Layout l) { return (l == Grid::Tiled) ? "tiled" : "linear"; }
+
+  // every vectorized advection kernel must give the scalar result (user-003)
+  void test_simd(WaveGrid::Settings s, int steps) {
+    s.layout = Grid::Linear;
+    s.fused  = false;
+    for (int isa = wsw::SSE2; isa <= wsw::best_simd_isa(); isa++) {
+      WaveGrid::Settings a = s;
+      a.simd = (wsw::SimdIsa)isa;
+      WaveGrid::Settings b = s;
+      b.simd = wsw::Scalar;
+      char name[64];
+      snprintf(name, sizeof(name), "%s = scalar", wsw::simd_isa_name((wsw::SimdIsa)isa));
+      check(name, compare(a, b, steps).amplitude, 0);
+    }
+  }
+
+  // the tiled passes must not depend on the thread count (user-004)
+  void test_threads(WaveGrid::Settings s, int steps) {
+    for (int fused = 0; fused <= 1; fused++) {
+      WaveGrid::Settings a = s;
+      a.layout          = Grid::Tiled;
+      a.fused           = fused != 0;
+      a.fused_min_bytes = 0;
+      a.threads         = 3;
+      WaveGrid::Settings b = a;
+      b.threads         = 1;
+      char name[64];
+      snprintf(name, sizeof(name), "3 threads = 1 thread, %s", fused ? "fused" : "two-pass");
+      check(name, compare(a, b, steps).amplitude, 0);
+    }
+  }
+
+  // the fused pass must give the two-pass result (user-005)
+  void test_fused(WaveGrid::Settings s, int steps) {
+    for (int layout = Grid::Linear; layout <= Grid::Tiled; layout++) {
+      s.layout          = (Grid::Layout)layout;
+      s.fused_min_bytes = 0;
+      WaveGrid::Settings a = s;
+      a.fused = true;
+      WaveGrid::Settings b = s;
+      b.fused = false;
+      char name[64];
+      snprintf(name, sizeof(name), "fused = two-pass, %s", layout_name(s.layout));
+      check(name, compare(a, b, steps, Dt, [&](const WaveGrid& grid, const WaveGrid&) {
+        check("  the fused pass ran", grid.GetTimings().fused > 0 ? 0 : 1, 0);
+      }).amplitude, 0);
+    }
+  }
+
+  // with a zero threshold, skipping calm tiles must change nothing (user-008);
+  // the steps are long enough for the longest waves to trace back out of the
+  // domain, so they come in through the boundary
+  void test_sparse(WaveGrid::Settings s, int steps) {
+    const Float dt = (Float)1.0;
+    s.calm_start     = true;
+    s.calm_threshold = 0;
+    WaveGrid::Settings a = s;
+    a.sparse = true;
+    WaveGrid::Settings b = s;
+    b.sparse = false;
+    Difference d = compare(a, b, steps, dt, [&](const WaveGrid& grid, const WaveGrid&) {
+      check("  calm tiles were skipped", grid.GetTimings().tiles < (long long)grid.TileCount() * steps ? 0 : 1, 0);
+    });
+    check("  waves came in", d.amplitude_peak > 0 ? 0 : 1, 0);
+    check("sparse = dense, calm start", d.amplitude, 0);
+  }
+
+  // steady-state steps must not allocate (user-013)
+  void test_allocations(WaveGrid::Settings s, int steps) {
+    for (int layout = Grid::Linear; layout <= Grid::Tiled; layout++) {
+      s.layout = (Grid::Layout)layout;
+      WaveGrid grid(s);
+      for (int i = 0; i < 2 * s.max_band_period; i++) {
+        grid.TimeStep(Dt);
+      }
+      long long before = wsw::heap_allocations();
+      for (int i = 0; i < steps; i++) {
+        grid.TimeStep(Dt);
+      }
+      char name[64];
+      snprintf(name, sizeof(name), "allocations in steady-state steps, %s", layout_name(s.layout));
+      check(name, (double)(wsw::heap_allocations() - before), 0);
+    }
+  }
+
+  // huge pages move the buffers, not the result (user-014)
+  void test_pages(WaveGrid::Settings s, int steps) {
+    s.layout = Grid::Tiled;
+    WaveGrid::Settings a = s;
+    a.huge_pages = true;
+    check("huge pages = default allocation", compare(a, s, steps).amplitude, 0);
+  }
+
+  // ensemble members must come out as the same grids stepped alone (user-017)
+  void test_ensemble(WaveGrid::Settings s, int steps) {
+    WaveEnsemble::Settings e;
+    e.threads = 2;
+    for (Float wind : { 5, 10 }) {
+      for (int n_theta : { s.n_theta, 2 * s.n_theta }) {
+        WaveGrid::Settings m  = s;
+        m.spectrum.wind_speed = wind;
+        m.n_theta             = n_theta;
+        e.members.push_back(m);
+      }
+    }
+    WaveEnsemble ensemble(e);
+    std::vector<std::unique_ptr<WaveGrid>> separate;
+    for (WaveGrid::Settings& m : e.members) {
+      m.threads = 1;
+      separate.emplace_back(new WaveGrid(m));
+    }
+    for (int i = 0; i < steps; i++) {
+      ensemble.TimeStep(Dt);
+      for (std::unique_ptr<WaveGrid>& grid : separate) {
+        grid->TimeStep(Dt);
+      }
+    }
+    double amplitude = 0, height = 0;
+    for (int m = 0; m < ensemble.Members(); m++) {
+      double peak;
+      amplitude = std::max(amplitude, (double)wsw::max_difference(ensemble.Member(m).Amplitude(), separate[m]->Amplitude()));
+      height    = std::max(height, wsw::height_difference(ensemble.Member(m), *separate[m], peak));
+    }
+    check("ensemble = separate grids, amplitude", amplitude, 0);
+    check("ensemble = separate grids, height", height, 0);
+  }
+
+  // the uniform shift must give the backtrace's result (user-021)
+  void test_shift(WaveGrid::Settings s, int steps) {
+    for (int fused = 0; fused <= 1; fused++) {
+      s.fused           = fused != 0;
+      s.fused_min_bytes = 0;
+      WaveGrid::Settings a = s;
+      a.uniform_shift = true;
+      WaveGrid::Settings b = s;
+      b.uniform_shift = false;
+      char name[64];
+      snprintf(name, sizeof(name), "uniform shift = backtrace, %s", fused ? "fused" : "two-pass");
+      check(name, compare(a, b, steps, Dt, [&](const WaveGrid& grid, const WaveGrid&) {
+        check("  slices were shifted", grid.GetTimings().shifted > 0 ? 0 : 1, 0);
+      }).amplitude, 0);
+    }
+  }
+
+  // replaying cached stencils must give the traced result (user-022)
+  void test_stencils(WaveGrid::Settings s, int steps) {
+    for (int shift = 0; shift <= 1; shift++) {
+      s.uniform_shift = shift != 0;
+      WaveGrid::Settings a = s;
+      a.cached_stencils = true;
+      WaveGrid::Settings b = s;
+      b.cached_stencils = false;
+      char name[64];
+      snprintf(name, sizeof(name), "cached stencils = traced, shift %s", shift ? "on" : "off");
+      check(name, compare(a, b, steps, Dt, [&](const WaveGrid& grid, const WaveGrid&) {
+        check("  stencils were built", grid.GetTimings().stencil_builds > 0 ? 0 : 1, 0);
+      }).amplitude, 0);
+    }
+  }
+
+  // adaptive theta strides must step fewer cells, with the surface within
+  // 0.2 of its peak; 0.17 at n_x 128 (user-012)
+  void test_theta(WaveGrid::Settings s, int steps) {
+    WaveGrid::Settings a = s;
+    a.max_theta_stride = std::max(s.n_theta / 4, 2);
+    Difference d = compare(a, s, steps, Dt, [&](const WaveGrid& grid, const WaveGrid& reference) {
+      check("  fraction of the cells stepped", (double)grid.GetTimings().cells / reference.GetTimings().cells, 0.95);
+    });
+    check("theta strides, height error / peak", d.height / d.height_peak, 0.2);
+  }
+
+  // multi-rate stepping must match every band stepped once per call within
+  // 1e-3 of the amplitude peak away from 8 nodes of the shore after 5 of the
+  // longest periods, as wsw_bench runs it; the difference the shore makes
+  // keeps spreading out with the reflected waves (user-023)
+  void test_bands(WaveGrid::Settings s) {
+    const Float ShoreNodes = 8;
+    const int   steps      = 5 * s.max_band_period;
+    s.n_zeta = std::max(s.n_zeta, 4);
+    WaveGrid::Settings a = s;
+    a.band_courant = (Float)0.25;
+    compare(a, s, steps, Dt, [&](const WaveGrid& grid, const WaveGrid& reference) {
+      wsw::ShoreDifference d = wsw::shore_difference(grid, reference, ShoreNodes);
+      check("multi-rate, amplitude error off the shore / peak", (double)(d.open / d.peak), 1e-3);
+    });
+  }
+
+  // coarser bands must keep the surface within the bound of each spacing
+  // (user-024)
+  void test_spacing(WaveGrid::Settings s, int steps) {
+    s.n_zeta = std::max(s.n_zeta, 4);
+    const double bounds[][2] = { { 0.5, 0.01 }, { 1.0, 0.2 }, { 4.0, 0.4 } };
+    for (const double* b : bounds) {
+      WaveGrid::Settings a = s;
+      a.band_spacing = (Float)b[0];
+      char name[64];
+      snprintf(name, sizeof(name), "band spacing %.1f, height error / peak", b[0]);
+      Difference d = compare(a, s, steps);
+      check(name, d.height / d.height_peak, b[1]);
+    }
+  }
+}
+
+int main(int argc, char* argv[]) {
+  WaveGrid::Settings s;
+  s.n_x     = 128;
+  s.n_theta = 16;
+  s.n_zeta  = 2;
+  s.threads = 1;
+  int  steps = 16;
+  bool ok    = true;
+  for (int i = 1; i < argc && ok; i++) {
+    const char* arg  = argv[i];
+    const char* next = (i + 1 < argc) ? argv[i + 1] : nullptr;
+    if      (!strcmp(arg, "--steps")   && next) { steps     = atoi(next); i++; }
+    else if (!strcmp(arg, "--n_x")     && next) { s.n_x     = atoi(next); i++; }
+    else if (!strcmp(arg, "--n_theta") && next) { s.n_theta = atoi(next); i++; }
+    else { ok = false; }
+  }
+  if (!ok || steps < 1 || s.n_x < 2 || s.n_theta < 1) {
+    printf("usage: %s [--steps N] [--n_x N] [--n_theta N]\n", argv[0]);
+    return 1;
+  }
+  printf("n_x = %d, n_theta = %d, n_zeta = %d, %d steps\n", s.n_x, s.n_theta, s.n_zeta, steps);
+  test_simd(s, steps);
+  test_threads(s, steps);
+  test_fused(s, steps);
+  test_sparse(s, steps);
+  test_allocations(s, steps);
+  test_pages(s, steps);
+  test_ensemble(s, steps);
+  test_shift(s, steps);
+  test_stencils(s, steps);
+  test_theta(s, steps);
+  test_bands(s);
+  test_spacing(s, steps);
+  printf("%d failed\n", g_failures);
+  return g_failures ? 1 : 0;
+}
@@ -0,0 +1,103 @@
+#include "wsw_thread_pool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(int threads) : m_fn(nullptr), m_ctx(nullptr), m_finished(0), m_generation(0), m_quit(false) {
+  if (threads <= 0) {
+    threads = std::max(1, (int)std::thread::hardware_concurrency());
+  }
+  for (int i = 0; i < threads; i++) {
+    m_queues.emplace_back(new Queue());
+  }
+  for (int i = 1; i < threads; i++) {
+    m_threads.emplace_back(&ThreadPool::worker_main, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_quit = true;
+  }
+  m_wake.notify_all();
+  for (std::thread& t : m_threads) {
+    t.join();
+  }
+}
+
+void ThreadPool::run(int count, TaskFn fn, const void* ctx) {
+  if (count <= 0) {
+    return;
+  }
+  int n = Size();
+  if (n == 1) {
+    for (int task = 0; task < count; task++) {
+      fn(ctx, task, 0);
+    }
+    return;
+  }
+  for (int w = 0; w < n; w++) { // workers are parked, no locking needed
+    m_queues[w]->begin = (int)((long long)count * w / n);
+    m_queues[w]->end   = (int)((long long)count * (w + 1) / n);
+  }
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_fn       = fn;
+    m_ctx      = ctx;
+    m_finished = 0;
+    m_generation++;
+  }
+  m_wake.notify_all();
+  work(0);
+  // every worker takes part in every generation, so once all of them have
+  // checked out nobody can still be touching the queues of this one
+  std::unique_lock<std::mutex> guard(m_lock);
+  m_done.wait(guard, [&] { return m_finished == n - 1; });
+}
+
+bool ThreadPool::pop(int worker, int& task) {
+  int n = Size();
+  {
+    Queue& q = *m_queues[worker];
+    std::lock_guard<std::mutex> guard(q.lock);
+    if (q.begin < q.end) {
+      task = q.begin++;
+      return true;
+    }
+  }
+  for (int i = 1; i < n; i++) {
+    Queue& q = *m_queues[(worker + i) % n];
+    std::lock_guard<std::mutex> guard(q.lock);
+    if (q.begin < q.end) {
+      task = --q.end;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::work(int worker) {
+  int task;
+  while (pop(worker, task)) {
+    m_fn(m_ctx, task, worker);
+  }
+}
+
+void ThreadPool::worker_main(int worker) {
+  unsigned seen = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> guard(m_lock);
+      m_wake.wait(guard, [&] { return m_quit || m_generation != seen; });
+      if (m_quit) {
+        return;
+      }
+      seen = m_generation;
+    }
+    work(worker);
+    {
+      std::lock_guard<std::mutex> guard(m_lock);
+      m_finished++;
+    }
+    m_done.notify_all();
+  }
+}
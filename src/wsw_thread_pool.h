@@ -0,0 +1,54 @@
+#ifndef WSW_THREAD_POOL_H
+#define WSW_THREAD_POOL_H
+
+// Fixed-size work-stealing pool for the tiled WaveGrid passes.
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+
+class ThreadPool {
+public:
+  // threads <= 0 uses every hardware thread; 1 runs everything on the caller
+  explicit ThreadPool(int threads);
+  ~ThreadPool();
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+  int Size() const { return (int)m_queues.size(); }
+  // Calls fn(task, worker) once for every task in [0, count) and returns when
+  // all of them are done. Each worker starts on its own contiguous block of
+  // tasks and steals from the back of the others' blocks once it runs dry.
+  // worker is in [0, Size()), the caller is worker 0.
+  template <class Fn>
+  void ParallelFor(int count, const Fn& fn) {
+    run(count, &invoke<Fn>, &fn);
+  }
+private:
+  typedef void (*TaskFn)(const void* fn, int task, int worker);
+  template <class Fn>
+  static void invoke(const void* fn, int task, int worker) { (*(const Fn*)fn)(task, worker); }
+  struct Queue {
+    std::mutex lock;
+    int        begin = 0;
+    int        end   = 0;
+  };
+  void run(int count, TaskFn fn, const void* ctx);
+  void work(int worker);
+  bool pop(int worker, int& task);
+  void worker_main(int worker);
+
+  std::vector<std::unique_ptr<Queue>> m_queues;
+  std::vector<std::thread>            m_threads;
+  std::mutex                          m_lock;
+  std::condition_variable             m_wake;
+  std::condition_variable             m_done;
+  TaskFn                              m_fn;
+  const void*                         m_ctx;
+  int                                 m_finished;   // workers done with this generation, guarded by m_lock
+  unsigned                            m_generation; // guarded by m_lock
+  bool                                m_quit;       // guarded by m_lock
+};
+
+#endif // WSW_THREAD_POOL_H